@@ -0,0 +1,55 @@
+// Micro-benchmark of hash_index against std::unordered_map on the checker's
+// workload: random two-lane keys, half of the lookups hitting. Run with
+// make bench.
+#include "hash_index.h"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+template<typename Map>
+void run(char const* name, vector<hash_t> const& keys, vector<hash_t> const& probes)
+{
+    auto t0 = chrono::steady_clock::now();
+    Map m;
+    for (size_t i = 0; i < keys.size(); ++i)
+        m.insert({keys[i], i});
+
+    auto t1 = chrono::steady_clock::now();
+    size_t hits = 0;
+    for (auto const& k : probes)
+    {
+        auto it = m.find(k);
+        if (it != m.end())
+            hits += it->second;
+    }
+    auto t2 = chrono::steady_clock::now();
+
+    // hits is printed so the lookups aren't optimized away
+    printf("%-14s insert %6.1f ns  find %6.1f ns  (%zu)\n", name,
+           chrono::duration<double, nano>(t1 - t0).count() / keys.size(),
+           chrono::duration<double, nano>(t2 - t1).count() / probes.size(),
+           hits);
+}
+
+int main()
+{
+    mt19937_64 rnd(1);
+    for (size_t n : {size_t(1) << 14, size_t(1) << 20})
+    {
+        vector<hash_t> keys(n), probes(1 << 24);
+        for (auto& k : keys)
+            for (auto& x : k)
+                x = rnd() * 64603473;   // low bits like a polynomial hash's
+        for (auto& p : probes)
+            p = (rnd() & 1) ? keys[rnd() % n] : hash_t{rnd(), rnd()};
+
+        printf("n=%zu\n", n);
+        run<unordered_map<hash_t, size_t, hash_t_hash>>("unordered_map", keys, probes);
+        run<hash_index<size_t>>("hash_index", keys, probes);
+    }
+}
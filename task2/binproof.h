@@ -0,0 +1,52 @@
+#ifndef BINPROOF_H
+#define BINPROOF_H
+
+#include "parsex.h"
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// Binary proof interchange format, shared by task2, task3 and task4 so that
+// chained stages pass trees instead of text. All integers are little-endian
+// u32 unless noted:
+//
+//   "PRF\1"                             magic and version
+//   vars_cnt, { len, name bytes }       variable names
+//   nodes_cnt, { u8 tag, operands }     every distinct subformula, children
+//                                       first; tag is operation_type or 4
+//                                       for a variable; operands: var index,
+//                                       one child id for NEG, two otherwise
+//   hyps_cnt, { node id }               hypotheses
+//   node id                             the proven formula
+//   u8 has_justifications
+//   lines_cnt, { node id [, u8 kind, a, b] }
+struct bin_proof
+{
+    enum class just_kind : uint8_t
+    {
+        NONE,
+        HYPOTHESIS,     // a: 1-based hypothesis number
+        AXIOM,          // a: scheme number
+        MODUS_PONENS    // a, b: 1-based lines of the implication and its premise
+    };
+
+    struct justification
+    {
+        just_kind   kind = just_kind::NONE;
+        uint32_t    a = 0;
+        uint32_t    b = 0;
+    };
+
+    std::vector<ast_expr_ptr>   hypotheses;
+    ast_expr_ptr                goal = nullptr;
+    std::vector<ast_expr_ptr>   lines;
+    std::vector<justification>  justifications; // empty, or one per line
+};
+
+bool    is_bin_proof(char const* begin, char const* end);
+bool    read_bin_proof(char const* begin, char const* end,
+                       ast_pool& pool, bin_proof& proof);
+void    write_bin_proof(std::ostream& o, bin_proof const& proof);
+
+#endif // BINPROOF_H
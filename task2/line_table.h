@@ -0,0 +1,41 @@
+#ifndef LINE_TABLE_H
+#define LINE_TABLE_H
+
+#include "parsex.h"
+
+#include <cstdint>
+#include <vector>
+
+// What the checker keeps of each proof line, in parallel arrays indexed by
+// the 0-based line number, so a line costs a few dozen bytes whatever its
+// formula. Formulas are interned, so the formula pointer stands for the
+// hashes and for the output text alike.
+struct line_table
+{
+    enum class kind : uint8_t
+    {
+        HYPOTHESIS,
+        AXIOM,
+        MODUS_PONENS
+    };
+
+    explicit line_table(std::vector<ast_expr_ptr>&& lines)
+        : formula(std::move(lines)),
+          kinds(formula.size()),
+          number(formula.size()),
+          impl(formula.size()),
+          premise(formula.size()),
+          mp_subtree_size(formula.size(), 1)
+    {}
+
+    size_t size() const { return formula.size(); }
+
+    std::vector<ast_expr_ptr>   formula;
+    std::vector<kind>           kinds;
+    std::vector<uint32_t>       number;     // of the hypothesis or the scheme, 1-based
+    std::vector<uint32_t>       impl;       // modus ponens dependencies, 0-based lines
+    std::vector<uint32_t>       premise;
+    std::vector<size_t>         mp_subtree_size;
+};
+
+#endif // LINE_TABLE_H
@@ -1,12 +1,20 @@
 #include "parsex.h"
 
 #include "unistd.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <iostream>
 #include <cstring>
 #include <cassert>
 #include <numeric>
 #include <functional>
 #include <sstream>
+#include <algorithm>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 using namespace std;
 
@@ -40,8 +48,8 @@ string to_string(lex_token const& token)
     {
     case 0:
         return to_string(get<token_type>(token));
-    case 1:
-        return get<varname>(token);
+    case 1: // the name lives in the pool
+        return "#" + std::to_string(get<var_id>(token));
     case 2:
         assert(false && "damn, that's not ok");
         return "null";
@@ -71,25 +79,44 @@ char const* to_string(operation_type const token_type)
 
 std::ostream& operator<<(std::ostream& o, ast_expression const& expr)
 {
-    if (expr.content.index() == 1) // var
-        return o << get<varname>(expr.content);
-
-    auto& op = get<ast_expression::operation>(expr.content);
-    if (op.op_type == operation_type::NEG)
-    {
-        assert(op.argv.size() == 1);
-        o << "!" << *op.argv[0].get();
-    } else
+    // Walks an explicit stack of (node, children printed so far), like the
+    // parser, so deep formulas don't overflow the native one
+    vector<pair<ast_expr_ptr, size_t>> stack{{&expr, 0}};
+    while (!stack.empty())
     {
-        o << '(';
-        assert(op.argv.size() > 1);
-        o << *op.argv[0];
-        for (size_t i = 1; i < op.argv.size(); ++i)
+        auto [e, printed] = stack.back();
+        if (e->content.index() == 1) // var
+        {
+            o << get<ast_expression::variable>(e->content).name;
+            stack.pop_back();
+            continue;
+        }
+
+        auto& op = get<ast_expression::operation>(e->content);
+        if (op.op_type == operation_type::NEG)
+        {
+            assert(op.argv.size() == 1);
+            if (printed == 0)
+                o << "!";
+        } else
+        {
+            assert(op.argv.size() > 1);
+            if (printed == 0)
+                o << '(';
+            else if (printed < op.argv.size())
+                o << " " << to_string(op.op_type) << " ";
+            else
+                o << ')';
+        }
+
+        if (printed == op.argv.size())
         {
-            assert(op.argv[i] != nullptr);
-            o << " " << to_string(op.op_type) << " " << *op.argv[i].get();
+            stack.pop_back();
+            continue;
         }
-        o << ')';
+        assert(op.argv[printed] != nullptr);
+        stack.back().second = printed + 1;
+        stack.emplace_back(op.argv[printed], 0);
     }
     return o;
 }
@@ -120,8 +147,12 @@ void move_data_to_front(reader_impl& rdr)
 size_t read_more(reader_impl& rdr)
 {
     assert(rdr.read_left <= rdr.read_right);
+    if (rdr.mapped)
+        return 0;
+
     move_data_to_front(rdr);
-    ssize_t cnt = read(fileno(stdin),
+    rdr.cls_base = nullptr; // the window contents are about to change
+    ssize_t cnt = read(rdr.fd,
                        const_cast<char*>(rdr.read_right),
                        reader_impl::buffer_size - read_size(rdr));
 
@@ -136,6 +167,36 @@ size_t read_more(reader_impl& rdr)
     return cnt;
 }
 
+bool map_input(reader_impl& rdr, int fd)
+{
+    rdr.fd = fd;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1
+     || !S_ISREG(st.st_mode)
+     || st.st_size == 0)
+        return false; // pipes and ttys go through read_more()
+
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+        return false;
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    // The mapping is never unmapped: spans into it live until exit.
+    attach(rdr, static_cast<char const*>(data),
+                static_cast<char const*>(data) + st.st_size);
+    return true;
+}
+
+void attach(reader_impl& rdr, char const* begin, char const* end)
+{
+    assert(begin <= end);
+    rdr.read_left = begin;
+    rdr.read_right = end;
+    rdr.cls_base = nullptr;
+    rdr.mapped = true;
+}
+
 static inline bool is_ws(char c)
 {
     return c == ' '
@@ -143,13 +204,6 @@ static inline bool is_ws(char c)
         || c == '\r';
 }
 
-void skip_ws(reader_impl& rdr)
-{
-    for (; rdr.read_left < rdr.read_right
-         && is_ws(*rdr.read_left); ++rdr.read_left)
-    {}
-}
-
 bool is_varname_char(char c)
 {
     return isupper(c)
@@ -157,29 +211,126 @@ bool is_varname_char(char c)
         || c == '\'';
 }
 
-varname read_var(reader_impl& rdr)
+#if defined(__AVX2__)
+static inline __m256i in_range(__m256i c, char lo, char hi)
+{
+    return _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8(lo - 1)),
+                            _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), c));
+}
+
+static inline char_classes classify_window(char const* p)
+{
+    char_classes result;
+    for (size_t i = 0; i < char_classes::window; i += 32)
+    {
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p + i));
+        __m256i ws = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(' ')),
+                                                     _mm256_cmpeq_epi8(c, _mm256_set1_epi8('\t'))),
+                                     _mm256_cmpeq_epi8(c, _mm256_set1_epi8('\r')));
+        __m256i var = _mm256_or_si256(_mm256_or_si256(in_range(c, 'A', 'Z'),
+                                                      in_range(c, '0', '9')),
+                                      _mm256_cmpeq_epi8(c, _mm256_set1_epi8('\'')));
+        result.ws |= uint64_t(uint32_t(_mm256_movemask_epi8(ws))) << i;
+        result.var |= uint64_t(uint32_t(_mm256_movemask_epi8(var))) << i;
+    }
+    return result;
+}
+#elif defined(__SSE2__)
+static inline __m128i in_range(__m128i c, char lo, char hi)
+{
+    return _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8(lo - 1)),
+                         _mm_cmplt_epi8(c, _mm_set1_epi8(hi + 1)));
+}
+
+static inline char_classes classify_window(char const* p)
+{
+    char_classes result;
+    for (size_t i = 0; i < char_classes::window; i += 16)
+    {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p + i));
+        __m128i ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(' ')),
+                                               _mm_cmpeq_epi8(c, _mm_set1_epi8('\t'))),
+                                  _mm_cmpeq_epi8(c, _mm_set1_epi8('\r')));
+        __m128i var = _mm_or_si128(_mm_or_si128(in_range(c, 'A', 'Z'),
+                                                in_range(c, '0', '9')),
+                                   _mm_cmpeq_epi8(c, _mm_set1_epi8('\'')));
+        result.ws |= uint64_t(uint32_t(_mm_movemask_epi8(ws))) << i;
+        result.var |= uint64_t(uint32_t(_mm_movemask_epi8(var))) << i;
+    }
+    return result;
+}
+#else
+static inline char_classes classify_window(char const* p)
+{
+    char_classes result;
+    for (size_t i = 0; i < char_classes::window; ++i)
+    {
+        result.ws |= uint64_t(is_ws(p[i])) << i;
+        result.var |= uint64_t(is_varname_char(p[i])) << i;
+    }
+    return result;
+}
+#endif
+
+// Classifies [p, p + n), n <= window; the bits past n are left clear
+static inline char_classes classify(char const* p, size_t n)
+{
+    if (n == char_classes::window)
+        return classify_window(p);
+
+    char tail[char_classes::window] = {};
+    memcpy(tail, p, n);
+    return classify_window(tail);
+}
+
+// Number of bytes of the given class starting at read_left. The classes are
+// computed a window at a time and reused until the reader leaves the window.
+static inline size_t run_length(reader_impl& rdr, uint64_t char_classes::* field)
+{
+    char const* p = rdr.read_left;
+    while (p < rdr.read_right)
+    {
+        if (rdr.cls_base == nullptr
+         || p < rdr.cls_base
+         || p >= rdr.cls_base + char_classes::window)
+        {
+            rdr.cls_base = p;
+            rdr.cls = classify(p, min<size_t>(char_classes::window, read_size(rdr) - (p - rdr.read_left)));
+        }
+
+        uint64_t stop = ~(rdr.cls.*field) >> (p - rdr.cls_base);
+        if (stop != 0)
+            return static_cast<size_t>(p - rdr.read_left) + __builtin_ctzll(stop);
+        p = rdr.cls_base + char_classes::window;
+    }
+    return read_size(rdr);
+}
+
+void skip_ws(reader_impl& rdr)
+{
+    rdr.read_left += run_length(rdr, &char_classes::ws);
+}
+
+var_id read_var(reader_impl& rdr, ast_pool& pool)
 {
     assert(isupper(*rdr.read_left));
-    string buf; // Praise for small obj optimization..
+    string buf; // only used when the name crosses a read_more()
     do
     {
         char const* start = rdr.read_left;
-        for (; rdr.read_left < rdr.read_right
-               && is_varname_char(*rdr.read_left);
-             ++rdr.read_left)
-        {}
+        rdr.read_left += run_length(rdr, &char_classes::var);
 
-        if (is_varname_char(*start))
-            buf.append(start, rdr.read_left);
-
-        if (read_size(rdr) == 0)
-        {
-            if (!read_more(rdr))
-                return buf;
-        } else
+        if (read_size(rdr) != 0 || rdr.mapped)
         {
-            return buf;
+            if (buf.empty())
+                return pool.var(string_view(start, rdr.read_left - start));
+            buf.append(start, rdr.read_left);
+            return pool.var(buf);
         }
+
+        buf.append(start, rdr.read_left);
+        if (!read_more(rdr))
+            return pool.var(buf);
     } while (true);
 }
 
@@ -190,30 +341,31 @@ bool goes_next(reader_impl& rdr,
     return equal(str.begin(), str.end(), rdr.read_left);
 }
 
-lex_token& read_token(reader_impl& rdr)
+lex_token& read_token(parser& prs)
 {
+    reader_impl& rdr = prs.rdr;
     skip_ws(rdr);
     while (read_size(rdr) == 0)
     {
         if (!read_more(rdr))
-            return rdr.cur_token = token_type::NO_TOKEN;
+            return prs.cur_token = token_type::NO_TOKEN;
         skip_ws(rdr);
     }
 
     if (isupper(*rdr.read_left))
     {
-        assert(rdr.cur_token.index() == 2);
-        return rdr.cur_token = read_var(rdr);
+        assert(prs.cur_token.index() == 2);
+        return prs.cur_token = read_var(rdr, prs.pool);
     }
 
     switch (*rdr.read_left)
     {
     case '(':
-        return rdr.cur_token = token_type::OP_BRACKET;
+        return prs.cur_token = token_type::OP_BRACKET;
     case ')':
-        return rdr.cur_token = token_type::CL_BRACKET;
+        return prs.cur_token = token_type::CL_BRACKET;
     case '&':
-        return rdr.cur_token = token_type::CONJ;
+        return prs.cur_token = token_type::CONJ;
     case '|':
         if (read_size(rdr) < 2)
         {
@@ -222,12 +374,12 @@ lex_token& read_token(reader_impl& rdr)
             if (read_size(rdr) < 2)
             {
                 assert(false && "Unexpected end of file!");
-                return rdr.cur_token = token_type::NO_TOKEN;
+                return prs.cur_token = token_type::NO_TOKEN;
             }
         }
         if (goes_next(rdr, "|-"))
-            return rdr.cur_token = token_type::NO_TOKEN;
-        return rdr.cur_token = token_type::DISJ;
+            return prs.cur_token = token_type::NO_TOKEN;
+        return prs.cur_token = token_type::DISJ;
     case '-':
         if (read_size(rdr) < 2)
         {
@@ -236,31 +388,32 @@ lex_token& read_token(reader_impl& rdr)
             if (read_size(rdr) < 2)
             {
                 assert(false && "Unexpected end of file!");
-                return rdr.cur_token = token_type::NO_TOKEN;
+                return prs.cur_token = token_type::NO_TOKEN;
             }
         }
 
         if (!goes_next(rdr, "->"))
-            return rdr.cur_token = token_type::NO_TOKEN;;
-        return rdr.cur_token = token_type::IMPL;
+            return prs.cur_token = token_type::NO_TOKEN;;
+        return prs.cur_token = token_type::IMPL;
     case '!':
-        return rdr.cur_token = token_type::NEG;
+        return prs.cur_token = token_type::NEG;
     case '\n':
         ++rdr.read_left;
-        return rdr.cur_token = token_type::NO_TOKEN;
+        return prs.cur_token = token_type::NO_TOKEN;
     default:
 //        assert(false && "Unexpected character");
-        return rdr.cur_token = token_type::NO_TOKEN;
+        return prs.cur_token = token_type::NO_TOKEN;
     }
 }
 
-void skip_token(reader_impl& rdr)
+void skip_token(parser& prs)
 {
-    switch (rdr.cur_token.index())
+    reader_impl& rdr = prs.rdr;
+    switch (prs.cur_token.index())
     {
     case 0:
     {
-        switch (get<token_type>(rdr.cur_token))
+        switch (get<token_type>(prs.cur_token))
         {
         case token_type::NO_TOKEN:
             assert(rdr.read_left == rdr.read_right);
@@ -281,9 +434,7 @@ void skip_token(reader_impl& rdr)
         }
     }
         break;
-    case 1:
-        assert(get<varname>(rdr.cur_token).size() == 0);
-        rdr.read_left += get<varname>(rdr.cur_token).size();
+    case 1: // read_var() has already consumed the name
         break;
     case 2:
         assert(false && "Skipping not processed token");
@@ -294,246 +445,174 @@ void skip_token(reader_impl& rdr)
     }
 
     assert(rdr.read_left <= rdr.read_right);
-    rdr.cur_token = nullptr;
+    prs.cur_token = nullptr;
 }
 
-lex_token& current_token(reader_impl& rdr)
+lex_token& current_token(parser& prs)
 {
-    if (rdr.cur_token.index() != 2)
-        return rdr.cur_token;
-    read_token(rdr);
-    return rdr.cur_token;
+    if (prs.cur_token.index() != 2)
+        return prs.cur_token;
+    return read_token(prs);
 }
 
-ast_expr_ptr construct_rassoc_ast(operation_type typ, // looks redundant
-                                  vector<ast_expr_ptr>& operands)
+ast_expr_ptr parse_var(parser& prs)
 {
-    ast_expr_ptr result;
-    assert(operands.size());
-    assert(typ != operation_type::NEG);
-
-    if (operands.size() == 1)
-    {
-        return move(operands[0]);
-    }
-
-    result = move(operands.back());
-    operands.pop_back();
-
-    return accumulate(operands.rbegin(),
-                      operands.rend(),
-                      move(result),
-                      [typ] (ast_expr_ptr& lhs,
-                             ast_expr_ptr& rhs)
-    {
-        vector<ast_expr_ptr> tmp_operands;
-        tmp_operands.reserve(2);
-        tmp_operands.push_back(move(rhs));
-        tmp_operands.push_back(move(lhs));
-        return make_unique<ast_expression>(ast_expression::operation{std::move(tmp_operands), typ});
-    });
+    return prs.pool.intern(read_var(prs.rdr, prs.pool));
 }
 
-ast_expr_ptr construct_lassoc_ast(operation_type typ, // looks redundant
-                                  vector<ast_expr_ptr>& operands)
+static inline int precedence(token_type type)
 {
-    ast_expr_ptr result;
-    assert(operands.size());
-    assert(typ != operation_type::NEG);
-
-    if (operands.size() == 1)
+    switch (type)
     {
-        return move(operands[0]);
+    case token_type::IMPL:
+        return 1;
+    case token_type::DISJ:
+        return 2;
+    case token_type::CONJ:
+        return 3;
+    case token_type::NEG:
+        return 4;
+    default: // OP_BRACKET, never reduced by an operator
+        return 0;
     }
-
-    return accumulate(operands.begin() + 1,
-                      operands.end(),
-                      move(operands[0]),
-                      [typ] (ast_expr_ptr& lhs,
-                             ast_expr_ptr& rhs)
-    {
-        vector<ast_expr_ptr> tmp_operands;
-        tmp_operands.reserve(2);
-        tmp_operands.push_back(move(lhs));
-        tmp_operands.push_back(move(rhs));
-        return make_unique<ast_expression>(ast_expression::operation{std::move(tmp_operands), typ});
-    });
 }
 
-ast_expr_ptr parse_var(reader_impl& rdr)
+// Whether the stacked operator applies before the incoming binary one:
+// & and | are left-associative, -> is right-associative
+static inline bool reduces_before(token_type stacked, token_type incoming)
 {
-    string varname = read_var(rdr);
-    assert(!varname.empty() && "Expected varname");
-
-    return make_unique<ast_expression>(std::move(varname));
+    return precedence(stacked) > precedence(incoming)
+        || (precedence(stacked) == precedence(incoming)
+            && incoming != token_type::IMPL);
 }
 
-ast_expr_ptr parse_implication(reader_impl& rdr);
-
-ast_expr_ptr parse_neg(reader_impl& rdr)
+static inline operation_type to_operation(token_type type)
 {
-    lex_token& token = current_token(rdr);
-    switch (token.index())
+    switch (type)
     {
-    case 0:
-    {
-        switch (get<token_type>(token))
-        {
-        case token_type::NEG:
-        {
-            vector<ast_expr_ptr> operands;
-            skip_token(rdr);
-            operands.push_back(parse_neg(rdr));
-            return make_unique<ast_expression>(ast_expression::operation{std::move(operands), operation_type::NEG});
-        }
-        case token_type::OP_BRACKET:
-        {
-            skip_token(rdr);
-            auto ret = parse_implication(rdr);
-            assert(current_token(rdr).index() == 0
-                   && get<token_type>(current_token(rdr)) == token_type::CL_BRACKET);
-            skip_token(rdr);
-            return ret;
-        }
-        case token_type::CONJ:
-        case token_type::DISJ:
-        case token_type::IMPL:
-        case token_type::CL_BRACKET:
-        case token_type::NO_TOKEN:
-            assert(false && "Expected expression");
-            return nullptr;
-        }
-    }
-    case 1:
-    {
-        auto ret = make_unique<ast_expression>(move(get<string>(token)));
-        skip_token(rdr);
-        return ret;
-    }
-    case 2:
+    case token_type::NEG:
+        return operation_type::NEG;
+    case token_type::CONJ:
+        return operation_type::CONJ;
+    case token_type::DISJ:
+        return operation_type::DISJ;
+    case token_type::IMPL:
+        return operation_type::IMPL;
     default:
-        assert(false && "Unexpected index");
-        return nullptr;
+        assert(false && "Not an operation");
+        return operation_type::NEG;
     }
 }
 
-ast_expr_ptr parse_conj(reader_impl& rdr)
+// Pops the top operator with its operands and pushes the result
+static void reduce(vector<ast_expr_ptr>& operands,
+                   vector<token_type>& operators,
+                   ast_pool& pool)
 {
-    vector<ast_expr_ptr> operands;
-    operands.reserve(2);
-    operands.push_back(parse_neg(rdr));
+    token_type type = operators.back();
+    operators.pop_back();
+    assert(type != token_type::OP_BRACKET);
 
-    while (true)
+    if (type == token_type::NEG)
     {
-        lex_token& token = current_token(rdr);
-        switch (token.index())
-        {
-        case 0:
-        {
-            switch(get<token_type>(token))
-            {
-            case token_type::CONJ:
-            {
-                skip_token(rdr);
-                operands.push_back(parse_neg(rdr));
-                continue;
-            }
-            default:
-                goto ret_st;
-            }
-        }
-        case 1:
-        case 2:
-        default:
-            assert(false && "Unexpected token");
-            return nullptr;
-        }
+        operands.back() = pool.intern(operation_type::NEG, {operands.back()});
+        return;
     }
-ret_st:
-    return construct_lassoc_ast(operation_type::CONJ, operands);
+
+    assert(operands.size() >= 2);
+    ast_expr_ptr rhs = operands.back();
+    operands.pop_back();
+    operands.back() = pool.intern(to_operation(type), {operands.back(), rhs});
 }
 
-ast_expr_ptr parse_disj(reader_impl& rdr)
+// Precedence climbing over explicit operand and operator stacks, so nesting
+// depth only grows the stacks and never the native one. Stops before the
+// first token that cannot continue the expression.
+ast_expr_ptr parse_implication(parser& prs)
 {
-    vector<ast_expr_ptr> operands;
-    operands.reserve(2);
-    operands.push_back(parse_conj(rdr));
+    ast_pool& pool = prs.pool;
+    auto& operands = prs.operands;
+    auto& operators = prs.operators;
+    operands.clear();
+    operators.clear();
+    size_t open_brackets = 0;
 
     while (true)
     {
-        lex_token& token = current_token(rdr);
-        switch (token.index())
+        // operand: prefix negations and brackets, then a variable
+        lex_token& token = current_token(prs);
+        if (token.index() == 1)
         {
-        case 0:
+            operands.push_back(pool.intern(get<var_id>(token)));
+            skip_token(prs);
+        } else if (token.index() == 0
+                && (get<token_type>(token) == token_type::NEG
+                 || get<token_type>(token) == token_type::OP_BRACKET))
         {
-            switch(get<token_type>(token))
-            {
-            case token_type::DISJ:
-            {
-                skip_token(rdr);
-                operands.push_back(parse_conj(rdr));
-                continue;
-            }
-            default:
-                goto ret_st;
-            }
-        }
-        case 1:
-        case 2:
-        default:
-            assert(false && "Unexpected token");
+            if (get<token_type>(token) == token_type::OP_BRACKET)
+                ++open_brackets;
+            operators.push_back(get<token_type>(token));
+            skip_token(prs);
+            continue;
+        } else
+        {
+            assert(false && "Expected expression");
             return nullptr;
         }
-    }
-ret_st:
-    return construct_lassoc_ast(operation_type::DISJ, operands);
-}
 
-ast_expr_ptr parse_implication(reader_impl& rdr)
-{
-    vector<ast_expr_ptr> operands;
-    operands.reserve(2);
-    operands.push_back(parse_disj(rdr));
-
-    while (true)
-    {
-        lex_token& token = current_token(rdr);
-        switch (token.index())
+        // closing brackets, then either a binary operator or the end
+        while (open_brackets != 0
+            && current_token(prs).index() == 0
+            && get<token_type>(current_token(prs)) == token_type::CL_BRACKET)
         {
-        case 0:
-        {
-            switch(get<token_type>(token))
-            {
-            case token_type::IMPL:
-            {
-                skip_token(rdr);
-                operands.push_back(parse_disj(rdr));
-                continue;
-            }
-            default:
-                goto ret_st;
-            }
+            while (operators.back() != token_type::OP_BRACKET)
+                reduce(operands, operators, pool);
+            operators.pop_back();
+            --open_brackets;
+            skip_token(prs);
         }
-        case 1:
-        case 2:
-        default:
+
+        lex_token& next = current_token(prs);
+        if (next.index() != 0)
+        {
             assert(false && "Unexpected token");
             return nullptr;
         }
+
+        token_type type = get<token_type>(next);
+        if (type != token_type::CONJ
+         && type != token_type::DISJ
+         && type != token_type::IMPL)
+            break;
+
+        while (!operators.empty() && reduces_before(operators.back(), type))
+            reduce(operands, operators, pool);
+        operators.push_back(type);
+        skip_token(prs);
     }
-ret_st:
-    return construct_rassoc_ast(operation_type::IMPL, operands);
+
+    if (open_brackets != 0)
+    {
+        assert(false && "Expected closing bracket");
+        return nullptr;
+    }
+
+    while (!operators.empty())
+        reduce(operands, operators, pool);
+    assert(operands.size() == 1);
+    return operands.back();
 }
 
-ast_expr_ptr parse_expr(reader_impl& rdr)
+ast_expr_ptr parse_expr(parser& prs)
 {
-    auto result = parse_implication(rdr);
-    reset(rdr);
+    auto result = parse_implication(prs);
+    reset(prs);
     return result;
 }
 
-void reset(reader_impl& rdr)
+void reset(parser& prs)
 {
+    reader_impl& rdr = prs.rdr;
     if (!read_size(rdr))
     {
         if (!read_more(rdr))
@@ -544,7 +623,7 @@ void reset(reader_impl& rdr)
 
     if (goes_next(rdr, "\n"))
         ++rdr.read_left;
-    rdr.cur_token = nullptr;
+    prs.cur_token = nullptr;
 }
 
 hash_t operator*(hash_t const& lhs,
@@ -565,38 +644,98 @@ hash_t operator+(hash_t const& lhs,
     return result;
 }
 
-static inline hash_t hash_from_size_t(size_t res)
+static_assert(hash_n >= 1 && hash_n <= 4, "1 to 4 hash lanes");
+
+// Every lane has its own prime and seed, so a collision has to happen in
+// every lane at once. Nothing here depends on the build or the standard
+// library, so hashes agree between task2, task3 and task4 binaries. The
+// lane loops have a fixed trip count and unroll: with AVX-512DQ they become
+// one vpmullq, otherwise independent multiplies that issue in parallel.
+static constexpr size_t lane_primes[] = {64603473ull,
+                                         0x9E3779B97F4A7C15ull,
+                                         0xC2B2AE3D27D4EB4Full,
+                                         0x165667B19E3779F9ull};
+static constexpr size_t lane_seeds[]  = {0x9AE16A3B2F90404Full,
+                                         0xCBF29CE484222325ull,
+                                         0x84222325CBF29CE4ull,
+                                         0xD6E8FEB86659FD93ull};
+
+static constexpr prime_v make_primes()
 {
-    hash_t h;
-    for (auto&& hi : h)
-        hi = res;
-    return h;
+    prime_v p{};
+    for (size_t i = 0; i < hash_n; ++i)
+        p[i] = lane_primes[i];
+    return p;
+}
+
+static constexpr prime_v P = make_primes();
+
+static constexpr size_t mix(size_t x)
+{
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
 }
 
-static inline hash_t hash_op(ast_expression::operation const& op)
+enum
 {
-    static prime_v const P{64603473};
-    static thread_local vector<prime_v> p_pows(1, hash_from_size_t(1));
+    op_types_cnt = 4
+};
 
-    size_t h0 = hash<char const*>()(to_string(op.op_type)); // too sleepy to write smth effecient..
-    hash_t h = hash_from_size_t(h0);
-    size_t i = 1;
-    for (auto&& child : op.argv)
+static_assert(static_cast<size_t>(operation_type::IMPL) + 1 == op_types_cnt,
+              "one seed per operation_type");
+
+using op_seeds_t = array<hash_t, op_types_cnt>;
+
+static constexpr op_seeds_t make_op_seeds()
+{
+    op_seeds_t seeds{};
+    for (size_t op = 0; op < op_types_cnt; ++op)
+        for (size_t i = 0; i < hash_n; ++i)
+            seeds[op][i] = mix(lane_seeds[i] + op + 1);
+    return seeds;
+}
+
+// Starting value of an operation node's hash, by operation_type
+static constexpr op_seeds_t op_seeds = make_op_seeds();
+
+// FNV-1a per lane, from different offset bases, so names colliding in one
+// lane don't in the others
+static hash_t hash_name(string_view name)
+{
+    hash_t h;
+    for (size_t i = 0; i < hash_n; ++i)
     {
-        while (p_pows.size() <= i)
+        size_t x = lane_seeds[i];
+        for (char c : name)
         {
-            p_pows.push_back(p_pows.back());
-            for (size_t i = 0; i < hash_n; ++i)
-                p_pows.back()[i] *= P[i];
+            x ^= static_cast<unsigned char>(c);
+            x *= 0x100000001B3ull;
         }
-
-        h = h + child->hashcode * p_pows[i];
-        i += child->subtree_sz;
+        h[i] = x;
     }
-
     return h;
 }
 
+// Polynomial hash over the preorder: the operation seed, then each child's
+// hash times P^(1 + sizes of the children before it). Every node keeps
+// P^subtree_sz, so a reduction costs a multiply per child and needs no
+// power table.
+static inline void hash_op(ast_expression::operation const& op,
+                           hash_t& h,
+                           hash_t& p_pow)
+{
+    h = op_seeds[static_cast<size_t>(op.op_type)];
+    p_pow = P;
+    for (auto&& child : op.argv)
+    {
+        h = h + child->hashcode * p_pow;
+        p_pow = p_pow * child->p_pow;
+    }
+}
+
 static inline size_t calc_subtree_sz(ast_expression::operation const& op)
 {
     size_t ans = 1;
@@ -610,16 +749,128 @@ static inline size_t calc_subtree_sz(ast_expression::operation const& op)
 
 ast_expression::ast_expression(ast_expression::operation &&op)
     : content(std::move(op)),
-      hashcode(hash_op(get<operation>(content))),
       subtree_sz(calc_subtree_sz(get<operation>(content)))
-{}
+{
+    hash_op(get<operation>(content), hashcode, p_pow);
+}
 
-ast_expression::ast_expression(string &&varname)
-    : content(std::move(varname)),
-      hashcode(hash_from_size_t(hash<std::string>()(get<string>(content)))),
-      subtree_sz(1u)
+ast_expression::ast_expression(variable var, hash_t const& name_hash)
+    : content(var),
+      hashcode(name_hash),
+      subtree_sz(1u),
+      p_pow(P)
 {}
 
+static inline bool shallow_equal(ast_expression const& lhs,
+                                 ast_expression const& rhs)
+{
+    if (lhs.content.index() != rhs.content.index())
+        return false;
+    if (lhs.content.index() == 1)
+        return get<ast_expression::variable>(lhs.content).id
+            == get<ast_expression::variable>(rhs.content).id;
+
+    // Children are interned, so comparing one level is a full structural compare
+    auto& lop = get<ast_expression::operation>(lhs.content);
+    auto& rop = get<ast_expression::operation>(rhs.content);
+    return lop.op_type == rop.op_type
+        && equal(lop.argv.begin(), lop.argv.end(),
+                 rop.argv.begin(), rop.argv.end());
+}
+
+void* ast_pool::allocate(size_t size, size_t align)
+{
+    size_t pad = (align - reinterpret_cast<uintptr_t>(block_left) % align) % align;
+    if (block_left == nullptr
+     || static_cast<size_t>(block_right - block_left) < pad + size)
+    {
+        size_t sz = max<size_t>(block_size, size + align);
+        blocks.push_back(make_unique<char[]>(sz));
+        block_left = blocks.back().get();
+        block_right = block_left + sz;
+        pad = (align - reinterpret_cast<uintptr_t>(block_left) % align) % align;
+    }
+
+    void* result = block_left + pad;
+    block_left += pad + size;
+    return result;
+}
+
+ast_expr_ptr& ast_pool::find_slot(ast_expression const& expr)
+{
+    if ((nodes_cnt + 1) * 2 > table.size())
+    {
+        vector<ast_expr_ptr> old(max<size_t>(table.size() * 2, 1024), nullptr);
+        swap(old, table);
+        for (auto node : old)
+            if (node != nullptr)
+                find_slot(*node) = node;
+    }
+
+    size_t const mask = table.size() - 1;
+    size_t i = ((hash_t_hash()(expr.hashcode) * 0x9E3779B97F4A7C15ull) >> 20) & mask;
+    for (;; i = (i + 1) & mask)
+    {
+        if (table[i] == nullptr || shallow_equal(*table[i], expr))
+            return table[i];
+    }
+}
+
+ast_expr_ptr ast_pool::insert(ast_expr_ptr& slot, ast_expression const& expr)
+{
+    ++nodes_cnt;
+    return slot = new (allocate(sizeof(ast_expression), alignof(ast_expression))) ast_expression(expr);
+}
+
+ast_expr_ptr ast_pool::intern(operation_type op_type,
+                              initializer_list<ast_expr_ptr> argv)
+{
+    ast_expression expr(ast_expression::operation{{argv.begin(), argv.size()}, op_type});
+    auto& slot = find_slot(expr);
+    if (slot != nullptr)
+        return slot;
+
+    auto* children = static_cast<ast_expr_ptr*>(allocate(sizeof(ast_expr_ptr) * argv.size(),
+                                                         alignof(ast_expr_ptr)));
+    copy(argv.begin(), argv.end(), children);
+    get<ast_expression::operation>(expr.content).argv = {children, argv.size()};
+    return insert(slot, expr);
+}
+
+var_id ast_pool::var(string_view varname)
+{
+    auto it = var_ids.find(varname);
+    if (it != var_ids.end())
+        return it->second;
+
+    auto* name = static_cast<char*>(allocate(varname.size(), 1));
+    copy(varname.begin(), varname.end(), name);
+    string_view stored(name, varname.size());
+
+    // The name is hashed here once; leaves are never looked up in the table
+    var_id id = static_cast<var_id>(leaves.size());
+    leaves.push_back(new (allocate(sizeof(ast_expression), alignof(ast_expression)))
+                     ast_expression(ast_expression::variable{id, stored},
+                                    hash_name(stored)));
+    var_ids.emplace(stored, id);
+    return id;
+}
+
+string_view ast_pool::name(var_id id) const
+{
+    return get<ast_expression::variable>(leaves[id]->content).name;
+}
+
+void ast_pool::clear()
+{
+    blocks.clear();
+    block_left = block_right = nullptr;
+    table.clear();
+    nodes_cnt = 0;
+    var_ids.clear();
+    leaves.clear();
+}
+
 std::string to_string(hash_t const& hsh)
 {
     stringstream ss;
@@ -643,14 +894,64 @@ bool eof(reader_impl& rdr)
     }
 }
 
-size_t hash_t_hash::operator()(hash_t const& H) const
+bool fill(reader_impl& rdr, size_t n)
 {
-    size_t ans = 0;
-    for (auto&& h : H)
+    while (read_size(rdr) < n)
     {
-        ans *= 31;
-        ans += h;
+        if (!read_more(rdr))
+            return false;
     }
+    return true;
+}
 
-    return ans;
+std::string read_rest(reader_impl& rdr)
+{
+    string result(rdr.read_left, rdr.read_right);
+    rdr.read_left = rdr.read_right;
+    while (read_more(rdr))
+    {
+        result.append(rdr.read_left, rdr.read_right);
+        rdr.read_left = rdr.read_right;
+    }
+    return result;
+}
+
+size_t hash_t_hash::operator()(hash_t const& H) const
+{
+    // lanes are independent hashes already, one is enough to pick a bucket
+    return H[0];
+}
+
+bool structurally_equal(ast_expr_ptr lhs, ast_expr_ptr rhs)
+{
+    // Equal subformulas of one pool share a node, so the walk stops there
+    // and only descends into parts built in different pools
+    vector<pair<ast_expr_ptr, ast_expr_ptr>> stack{{lhs, rhs}};
+    while (!stack.empty())
+    {
+        auto [l, r] = stack.back();
+        stack.pop_back();
+        if (l == r)
+            continue;
+        if (l->hashcode != r->hashcode
+         || l->subtree_sz != r->subtree_sz
+         || l->content.index() != r->content.index())
+            return false;
+
+        if (l->content.index() == 1)
+        {
+            if (get<ast_expression::variable>(l->content).name
+             != get<ast_expression::variable>(r->content).name)
+                return false;
+            continue;
+        }
+
+        auto& lop = get<ast_expression::operation>(l->content);
+        auto& rop = get<ast_expression::operation>(r->content);
+        if (lop.op_type != rop.op_type || lop.argv.size() != rop.argv.size())
+            return false;
+        for (size_t i = 0; i < lop.argv.size(); ++i)
+            stack.emplace_back(lop.argv[i], rop.argv[i]);
+    }
+    return true;
 }
@@ -5,6 +5,10 @@
 #include <memory>
 #include <variant>
 #include <array>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <cstdint>
 
 enum class token_type
 {
@@ -25,8 +29,20 @@ enum class operation_type
     IMPL
 };
 
-using varname = std::string;
-using lex_token = std::variant<token_type, varname, std::nullptr_t>;
+using var_id = uint32_t; // dense per-pool variable id, see ast_pool::var()
+using lex_token = std::variant<token_type, var_id, std::nullptr_t>;
+
+// Byte classes of an input window, bit i standing for its i-th byte
+struct char_classes
+{
+    enum
+    {
+        window = 64u
+    };
+
+    uint64_t ws = 0;    // ' ', '\t', '\r'
+    uint64_t var = 0;   // variable name characters, [A-Z0-9']
+};
 
 struct reader_impl
 {
@@ -38,12 +54,15 @@ struct reader_impl
     char        read_buffer[buffer_size];
     char const* read_left = read_buffer;
     char const* read_right = read_buffer;
-    lex_token   cur_token = nullptr;
+    char const* cls_base = nullptr; // cls describes [cls_base, cls_base + window)
+    char_classes cls;
+    int         fd = 0;         // read_more() source
+    bool        mapped = false; // [read_left, read_right) is the whole input, no read_more()
 };
 
 enum
 {
-    hash_n = 1
+    hash_n = 2  // independent polynomial hash lanes, 1 to 4
 };
 
 
@@ -54,35 +73,118 @@ struct hash_t_hash
     size_t operator()(hash_t const& H) const;
 };
 
+struct ast_expression;
+using ast_expr_ptr = ast_expression const*;
+
 struct ast_expression
 {
+    // Children array, owned by the ast_pool the node lives in
+    struct chld_v
+    {
+        ast_expr_ptr const* data;
+        size_t              n;
+
+        ast_expr_ptr const* begin() const { return data; }
+        ast_expr_ptr const* end() const { return data + n; }
+        size_t size() const { return n; }
+        ast_expr_ptr operator[](size_t i) const { return data[i]; }
+    };
+
     struct operation
     {
-        std::vector<std::unique_ptr<ast_expression>> argv;
+        chld_v argv;
         operation_type op_type;
     };
 
+    // Leaf; the name is only kept for output, everything else goes by id
+    struct variable
+    {
+        var_id           id;
+        std::string_view name;
+    };
+
     ast_expression(operation&& op);
-    ast_expression(std::string&& varname);
+    ast_expression(variable var, hash_t const& name_hash);
 
-    std::variant<operation, varname> content;
+    std::variant<operation, variable> content;
     hash_t hashcode;
     size_t const subtree_sz;
+    hash_t p_pow;   // P^subtree_sz, for hashing the parents
+};
+
+// Owns every node of a proof, with child arrays and variable names, in a bump
+// arena that is freed at once. Nodes are hash-consed: intern() returns the
+// existing node for a formula, so structurally equal formulas are pointer-equal.
+// Children passed to intern() must belong to the same pool.
+// Variable names are interned once into dense ids, each id owning its leaf.
+class ast_pool
+{
+public:
+    ast_pool() = default;
+    ast_pool(ast_pool const&) = delete;
+    ast_pool& operator=(ast_pool const&) = delete;
+
+    ast_expr_ptr    intern(operation_type op_type,
+                           std::initializer_list<ast_expr_ptr> argv);
+    ast_expr_ptr    intern(var_id id) const { return leaves[id]; }
+    ast_expr_ptr    intern(std::string_view varname) { return intern(var(varname)); }
+    var_id          var(std::string_view varname);
+    std::string_view name(var_id id) const;
+    size_t          vars_count() const { return leaves.size(); }
+    void            clear();
+
+private:
+    enum
+    {
+        block_size = 1u << 16
+    };
+
+    void*           allocate(size_t size, size_t align);
+    ast_expr_ptr&   find_slot(ast_expression const& expr);
+    ast_expr_ptr    insert(ast_expr_ptr& slot, ast_expression const& expr);
+
+    std::vector<std::unique_ptr<char[]>>    blocks;
+    char*                                   block_left = nullptr;
+    char*                                   block_right = nullptr;
+    std::vector<ast_expr_ptr>               table; // open addressing, size is a power of 2
+    size_t                                  nodes_cnt = 0;
+    std::unordered_map<std::string_view, var_id> var_ids; // keys point into the arena
+    std::vector<ast_expr_ptr>               leaves;  // by var_id
 };
 
-using ast_expr_ptr = std::unique_ptr<ast_expression>;
+// Parsing state over one input: the lookahead token and the operator
+// precedence stacks, with the pool formulas are interned into. Parsers share
+// no state, so separate inputs can be parsed side by side.
+struct parser
+{
+    parser(reader_impl& rdr, ast_pool& pool)
+        : rdr(rdr),
+          pool(pool)
+    {}
+
+    reader_impl&                rdr;
+    ast_pool&                   pool;
+    lex_token                   cur_token = nullptr;
+    std::vector<ast_expr_ptr>   operands;   // parse_expr() stacks, kept to reuse the memory
+    std::vector<token_type>     operators;
+};
 
 // helpers
-ast_expr_ptr    parse_expr(reader_impl& rdr);
-void            reset(reader_impl& rdr);
+ast_expr_ptr    parse_expr(parser& prs);
+bool            map_input(reader_impl& rdr, int fd);
+void            attach(reader_impl& rdr, char const* begin, char const* end);
+void            reset(parser& prs);
 bool            goes_next(reader_impl& rdr, std::string const& str);
 bool            eof(reader_impl& rdr);
+bool            fill(reader_impl& rdr, size_t n);  // false if the input ends first
+std::string     read_rest(reader_impl& rdr);
 
 // output helpers
 char const*     to_string(token_type token_type);
 char const*     to_string(operation_type const token_type);
 std::string     to_string(lex_token const& token_type);
 std::string     to_string(hash_t const& hsh);
+bool            structurally_equal(ast_expr_ptr lhs, ast_expr_ptr rhs);
 std::ostream&   operator<<(std::ostream& o, ast_expression const& expr);
 
 #endif // PARSEX_H
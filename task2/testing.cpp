@@ -1,215 +1,605 @@
 #include "parsex.h"
+#include "binproof.h"
+#include "axioms.h"
+#include "hash_index.h"
+#include "mp_index.h"
+#include "line_table.h"
 #include <iostream>
 #include <unordered_map>
 #include <unordered_set>
 #include <cassert>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <optional>
+#include <algorithm>
+#include <numeric>
+#include <thread>
+#include <fstream>
+#include <atomic>
 
 using namespace std;
 
-struct ast_record
-{
-    using mp_dependencies_t = pair<ast_record*, ast_record*>;
-
-    variant<ast_expr_ptr, string>   ast;        // main memory optimization
-    optional<string>                annotation;
-    optional<mp_dependencies_t>     modus_ponens_deps;
-    bool                            was_used_to_prove = 0;
-    size_t                          id = 0;
-    size_t                          mp_subtree_size = 1;
-    hash_t                          hashcode;
-    optional<hash_t>                l_hash;
-
-    ast_record(ast_expr_ptr ptr)
-        : ast(move(ptr)),
-          hashcode(get<ast_expr_ptr>(ast)->hashcode)
-    {}
-};
-
-bool is_op(ast_expression* ptr)
+bool is_op(ast_expr_ptr ptr)
 {
     return ptr->content.index() == 0;
 }
 
-auto& get_op(ast_expression* ptr)
+auto& get_op(ast_expr_ptr ptr)
 {
     return get<ast_expression::operation>(ptr->content);
 }
 
-bool is_op(ast_expression* ptr, operation_type type)
+bool is_op(ast_expr_ptr ptr, operation_type type)
 {
     return is_op(ptr)
         && get_op(ptr).op_type == type;
 }
 
-ast_expression* subtree(ast_expression* ptr, size_t ind)
+ast_expr_ptr subtree(ast_expr_ptr ptr, size_t ind)
 {
     assert(ind >= 0 && ind <= 1);
-    return get_op(ptr).argv[ind].get();
+    return get_op(ptr).argv[ind];
 }
 
-bool check_if_axiom(ast_record* ast_rec)
-{
-    ast_expression* ast = get<ast_expr_ptr>(ast_rec->ast).get();
-    if (!is_op(ast)) return false;
+// Set by --axioms when the file differs from the built-in schemes
+static axiom_system const* loaded_axioms = nullptr;
 
-    auto& op = get_op(ast);
-    if (op.op_type != operation_type::IMPL) return false;
+// Number of the scheme ast is an instance of, 0 if none
+static inline int axiom_scheme(ast_expr_ptr ast)
+{
+    return loaded_axioms != nullptr ? match_axiom(*loaded_axioms, ast)
+                                    : match_axiom<classical_axioms>(ast);
+}
 
-    // 1. A->(B->A)
-    if (is_op(subtree(ast, 1))
-        && get_op(subtree(ast, 1)).op_type == operation_type::IMPL
-        && subtree(subtree(ast, 1), 1)->hashcode == subtree(ast, 0)->hashcode)
+// Reads the schemes of an axiom system, one per line, numbered in order;
+// blank lines and lines starting with '#' are skipped. Exits on an error.
+unique_ptr<axiom_system> read_axioms(char const* path)
+{
+    ifstream in(path);
+    if (!in)
     {
-        ast_rec->annotation = "Ax. sch. 1";
-        return true;
+        cout << "Can't open " << path << endl;
+        exit(0);
     }
-    // 2. (A->B) -> (A->B->C) -> (A->C)
-    if (is_op(subtree(ast, 0), operation_type::IMPL)
-        && is_op(subtree(ast, 1), operation_type::IMPL)
-        && is_op(subtree(subtree(ast, 1), 0), operation_type::IMPL)
-        && is_op(subtree(subtree(ast, 1), 1), operation_type::IMPL)
-        && is_op(subtree(subtree(subtree(ast, 1), 0), 1), operation_type::IMPL)
-        && subtree(subtree(ast, 0), 0)->hashcode == subtree(subtree(subtree(ast, 1), 0), 0)->hashcode // | matching A
-        && subtree(subtree(ast, 0), 0)->hashcode == subtree(subtree(subtree(ast, 1), 1), 0)->hashcode // |
-        && subtree(subtree(ast, 0), 1)->hashcode == subtree(subtree(subtree(subtree(ast, 1), 0), 1), 0)->hashcode
-        && subtree(subtree(subtree(subtree(ast, 1), 0), 1), 1)->hashcode == subtree(subtree(subtree(ast, 1), 1), 1)->hashcode)
-    {
-        ast_rec->annotation = "Ax. sch. 2";
-        return true;
-    }
-    // 3. A->B->A&B
-    if (is_op(subtree(ast, 1), operation_type::IMPL)
-        && is_op(subtree(subtree(ast, 1), 1), operation_type::CONJ)
-        && subtree(ast, 0)->hashcode == subtree(subtree(subtree(ast, 1), 1), 0)->hashcode
-        && subtree(subtree(ast, 1), 0)->hashcode == subtree(subtree(subtree(ast, 1), 1), 1)->hashcode)
+
+    auto system = make_unique<axiom_system>();
+    string text;
+    for (size_t line = 1; getline(in, text); ++line)
     {
-        ast_rec->annotation = "Ax. sch. 3";
-        return true;
+        auto begin = text.find_first_not_of(" \t\r");
+        if (begin == string::npos || text[begin] == '#')
+            continue;
+
+        if (!system->add(text))
+        {
+            cout << path << ":" << line << ": more than " << max_schemes << " schemes" << endl;
+            exit(0);
+        }
+        if (auto error = system->schemes[system->schemes_cnt - 1].error)
+        {
+            cout << path << ":" << line << ": " << error << endl;
+            exit(0);
+        }
     }
 
-    // 4. A&B->A
-    if (is_op(subtree(ast, 0), operation_type::CONJ)
-        && subtree(subtree(ast, 0), 0)->hashcode == subtree(ast, 1)->hashcode)
+    system->compile();
+    if (system->error != nullptr)
     {
-        ast_rec->annotation = "Ax. sch. 4";
-        return true;
+        cout << path << ": " << system->error << endl;
+        exit(0);
     }
+    return system;
+}
+
+// Set by --verify: hash hits are confirmed by comparing the formulas
+static bool verify_hits = false;
 
-    // 5. A&B->B
-    if (is_op(subtree(ast, 0), operation_type::CONJ)
-        && subtree(subtree(ast, 0), 1)->hashcode == subtree(ast, 1)->hashcode)
+static inline bool same_formula(ast_expr_ptr lhs, ast_expr_ptr rhs)
+{
+    return !verify_hits || structurally_equal(lhs, rhs);
+}
+
+// 1-based number of the hypothesis ast is, 0 if none
+template<typename Container>
+size_t hypotesis_number(ast_expr_ptr ast,
+                        Container const& mp,
+                        vector<ast_expr_ptr> const& hypotheses_order)
+{
+    auto f = mp.find(ast->hashcode);
+    if (f == mp.end()
+     || !same_formula(hypotheses_order[f->second - 1], ast))
+        return 0;
+    return f->second;
+}
+
+// The lines the goal line depends on, itself included. A line only
+// depends on lines before it, so one backward sweep over the bitset finds
+// them all, looking at each line once however much the proof is shared.
+vector<bool> mark_dependencies(line_table const& lines, uint32_t goal)
+{
+    vector<bool> used(lines.size());
+    used[goal] = true;
+    for (uint32_t i = goal + 1; i-- > 0; )
     {
-        ast_rec->annotation = "Ax. sch. 5";
-        return true;
+        if (!used[i] || lines.kinds[i] != line_table::kind::MODUS_PONENS)
+            continue;
+        assert(lines.impl[i] < i && lines.premise[i] < i);
+        used[lines.impl[i]] = true;
+        used[lines.premise[i]] = true;
     }
+    return used;
+}
+
+using hash_to_line_t = hash_index<uint32_t>;
+using id_by_hash_t = hash_index<size_t>;
 
-    // 6. A->A|B
-    if (is_op(subtree(ast, 1), operation_type::DISJ)
-        && subtree(ast, 0)->hashcode == subtree(subtree(ast, 1), 0)->hashcode)
+// For each formula proven by modus ponens, by the line it first occurs on,
+// every pair of lines (implication, premise) it follows from. The pairs are
+// first occurrences too; one justifies the formula at any of its
+// occurrences after both lines.
+using mp_choices_t = vector<vector<pair<uint32_t, uint32_t>>>;
+
+mp_choices_t mp_choices(line_table const& lines, hash_to_line_t const& first)
+{
+    mp_choices_t result(lines.size());
+    for (uint32_t i = 0; i < lines.size(); ++i)
     {
-        ast_rec->annotation = "Ax. sch. 6";
-        return true;
+        ast_expr_ptr const ptr = lines.formula[i];
+        if (!is_op(ptr, operation_type::IMPL)
+         || first.find(ptr->hashcode)->second != i)
+            continue;
+
+        auto premise = first.find(subtree(ptr, 0)->hashcode);
+        auto target = first.find(subtree(ptr, 1)->hashcode);
+        if (premise == first.end() || target == first.end())
+            continue;
+
+        uint32_t const t = target->second;
+        if (lines.kinds[t] == line_table::kind::MODUS_PONENS
+         && same_formula(subtree(ptr, 1), lines.formula[t])
+         && same_formula(subtree(ptr, 0), lines.formula[premise->second]))
+            result[t].emplace_back(i, premise->second);
     }
+    return result;
+}
 
-    // 7. B->A|B
-    if (is_op(subtree(ast, 1), operation_type::DISJ)
-        && subtree(ast, 0)->hashcode == subtree(subtree(ast, 1), 1)->hashcode)
+// --minimize
+enum class minimize_mode
+{
+    NONE,
+    GREEDY,
+    EXACT
+};
+
+static size_t count_used(vector<bool> const& used)
+{
+    return count(used.begin(), used.end(), true);
+}
+
+// Rejustifies the lines the goal depends on so that fewer distinct lines
+// are needed. Going down from the goal, each needed line takes the pair
+// that adds the least to what is needed already: a line needed already
+// is free, any other costs its proof tree size. The lines keep their
+// justifications if that doesn't come out shorter.
+void minimize_greedy(line_table& lines, mp_choices_t const& choices, uint32_t goal)
+{
+    auto const impl = lines.impl;
+    auto const premise = lines.premise;
+    size_t const before = count_used(mark_dependencies(lines, goal));
+
+    vector<bool> needed(lines.size());
+    needed[goal] = true;
+    for (uint32_t i = goal + 1; i-- > 0; )
     {
-        ast_rec->annotation = "Ax. sch. 7";
-        return true;
+        if (!needed[i] || lines.kinds[i] != line_table::kind::MODUS_PONENS)
+            continue;
+
+        auto extra = [&] (uint32_t j) { return needed[j] ? 0 : lines.mp_subtree_size[j]; };
+        size_t best = mp_cost(extra(lines.impl[i]), extra(lines.premise[i]));
+        for (auto [a, b] : choices[i])
+        {
+            if (max(a, b) >= i)
+                continue;
+            size_t cost = mp_cost(extra(a), extra(b));
+            if (cost < best)
+            {
+                best = cost;
+                lines.impl[i] = a;
+                lines.premise[i] = b;
+            }
+        }
+        needed[lines.impl[i]] = true;
+        needed[lines.premise[i]] = true;
     }
 
-    // 8. (A->C) -> (B->C) -> (A|B->C)
-    if (is_op(subtree(ast, 0), operation_type::IMPL)
-        && is_op(subtree(ast, 1), operation_type::IMPL)
-        && is_op(subtree(subtree(ast, 1), 0), operation_type::IMPL)
-        && is_op(subtree(subtree(ast, 1), 1), operation_type::IMPL)
-        && is_op(subtree(subtree(subtree(ast, 1), 1), 0), operation_type::DISJ)
-        && subtree(subtree(ast, 0), 0)->hashcode == subtree(subtree(subtree(subtree(ast, 1), 1), 0), 0)->hashcode // match A
-        && subtree(subtree(subtree(ast, 1), 0), 0)->hashcode == subtree(subtree(subtree(subtree(ast, 1), 1), 0), 1)->hashcode //match B
-        && subtree(subtree(ast, 0), 1)->hashcode == subtree(subtree(subtree(ast, 1), 0), 1)->hashcode   // C
-        && subtree(subtree(ast, 0), 1)->hashcode == subtree(subtree(subtree(ast, 1), 1), 1)->hashcode)  // C
+    if (count_used(needed) > before)
     {
-        ast_rec->annotation = "Ax. sch. 8";
-        return true;
+        lines.impl = impl;
+        lines.premise = premise;
     }
+}
 
-    // 9. (A->B) -> (A->!B) -> !B
-    if (is_op(subtree(ast, 0), operation_type::IMPL)
-        && is_op(subtree(ast, 1), operation_type::IMPL)
-        && is_op(subtree(subtree(ast, 1), 0), operation_type::IMPL)
-        && is_op(subtree(subtree(ast, 1), 1), operation_type::NEG)
-        && is_op(subtree(subtree(subtree(ast, 1), 0), 1), operation_type::NEG)
-        && subtree(subtree(ast, 0), 0)->hashcode == subtree(subtree(subtree(ast, 1), 0), 0)->hashcode
-        && subtree(subtree(ast, 0), 0)->hashcode == subtree(subtree(subtree(ast, 1), 1), 0)->hashcode
-        && subtree(subtree(ast, 0), 1)->hashcode == subtree(subtree(subtree(subtree(ast, 1), 0), 1), 0)->hashcode)
+// Tries every choice of justifications for the formulas the goal depends
+// on and keeps one that needs the fewest lines. A formula proven by modus
+// ponens may be justified at any line it occurs on, by any pair proven
+// before that line, so a repeated formula can take a pair its first
+// occurrence comes too early for; hypotheses and axioms stay on their
+// first lines, which is never worse. The search sweeps the lines down from
+// the goal: each line of a formula still to be justified either takes one
+// of its pairs or leaves the formula to an earlier line.
+//
+// Exponential, so meant for short proofs: after max_steps choices it stops
+// with the best proof found so far, which is never worse than what
+// minimize_greedy() gives, and returns false. goal becomes the line the
+// proof ends on.
+bool minimize_exact(line_table& lines,
+                    mp_choices_t const& choices,
+                    hash_to_line_t const& first,
+                    uint32_t& goal)
+{
+    enum : size_t
     {
-        ast_rec->annotation = "Ax. sch. 9";
-        return true;
+        max_steps = size_t(1) << 24
+    };
+    static uint32_t const none = UINT32_MAX;
+
+    struct frame
+    {
+        uint32_t    line;
+        uint32_t    choice;     // next one to try, choices.size() leaves the formula to an earlier line
+        uint32_t    taken;      // the pair the line was given, none if none
+        size_t      added;      // formulas that pair made needed
+    };
+
+    minimize_greedy(lines, choices, goal);
+    size_t best = count_used(mark_dependencies(lines, goal));
+    vector<frame> best_taken;
+
+    // formulas go by the line they first occur on
+    vector<uint32_t> formula(lines.size());
+    for (uint32_t i = 0; i < lines.size(); ++i)
+    {
+        uint32_t const f = first.find(lines.formula[i]->hashcode)->second;
+        formula[i] = same_formula(lines.formula[f], lines.formula[i]) ? f : none;
     }
 
-    // 10. !!A->A
-    if (is_op(subtree(ast, 0), operation_type::NEG)
-        && is_op(subtree(subtree(ast, 0), 0), operation_type::NEG)
-        && subtree(subtree(subtree(ast, 0), 0), 0)->hashcode == subtree(ast, 1)->hashcode)
+    vector<uint32_t> refs(lines.size());    // by how many chosen pairs a formula is needed
+    vector<bool> justified(lines.size());   // whether a line of the formula took a pair
+    refs[goal] = 1;
+    size_t needed = 1;
+
+    // the next line below end of a formula still to justify, none if none is left
+    auto next = [&] (uint32_t end)
     {
-        ast_rec->annotation = "Ax. sch. 10";
-        return true;
+        while (end-- > 0)
+        {
+            uint32_t const f = formula[end];
+            if (f != none
+             && refs[f] != 0
+             && !justified[f]
+             && lines.kinds[end] == line_table::kind::MODUS_PONENS)
+                return end;
+        }
+        return none;
+    };
+
+    size_t steps = 0;
+    vector<frame> stack;
+    if (uint32_t top = next(static_cast<uint32_t>(lines.size())); top != none)
+        stack.push_back({top, 0, none, 0});
+    while (!stack.empty() && steps < max_steps)
+    {
+        auto& f = stack.back();
+        uint32_t const at = formula[f.line];
+        auto const& pairs = choices[at];
+        if (f.taken != none)
+        {
+            auto [a, b] = pairs[f.taken];
+            --refs[a];
+            --refs[b];
+            needed -= f.added;
+            justified[at] = false;
+            f.taken = none;
+        }
+
+        // formulas justified above can't be used this low, nor the one
+        // being justified
+        while (f.choice < pairs.size()
+            && (max(pairs[f.choice].first, pairs[f.choice].second) >= f.line
+             || pairs[f.choice].second == at
+             || justified[pairs[f.choice].first]
+             || justified[pairs[f.choice].second]))
+            ++f.choice;
+        if (f.choice > pairs.size() || (f.choice == pairs.size() && f.line == at))
+        {
+            stack.pop_back();
+            continue;
+        }
+
+        ++steps;
+        if (f.choice++ < pairs.size())
+        {
+            f.taken = f.choice - 1;
+            auto [a, b] = pairs[f.taken];
+            justified[at] = true;
+            f.added = (refs[a]++ == 0) + (refs[b]++ == 0);
+            needed += f.added;
+            if (needed >= best)
+                continue;
+        }
+
+        uint32_t const i = next(f.line);
+        if (i != none)
+        {
+            stack.push_back({i, 0, none, 0});
+            continue;
+        }
+        best = needed;
+        best_taken = stack;
     }
 
-    return false;
+    if (!best_taken.empty())
+    {
+        // a formula is on the line that took its pair, else on its first one
+        vector<uint32_t> line_of(lines.size());
+        iota(line_of.begin(), line_of.end(), 0);
+        for (auto const& f : best_taken)
+            if (f.taken != none)
+                line_of[formula[f.line]] = f.line;
+
+        for (auto const& f : best_taken)
+        {
+            if (f.taken == none)
+                continue;
+            auto [a, b] = choices[formula[f.line]][f.taken];
+            lines.impl[f.line] = line_of[a];
+            lines.premise[f.line] = line_of[b];
+        }
+        goal = line_of[goal];
+    }
+    return stack.empty();
 }
 
-template<typename Container>
-bool check_if_hypotesis(ast_record* ast_rec,
-                        Container const& mp)
+// Parses the lines of [begin, end). Generated proofs repeat the same lines
+// over and over, so lines already seen in this chunk are looked up by their
+// raw bytes instead of being parsed again.
+void parse_chunk(char const* begin,
+                 char const* end,
+                 ast_pool& pool,
+                 vector<ast_expr_ptr>& lines)
 {
-    auto f = mp.find(get<ast_expr_ptr>(ast_rec->ast)->hashcode);
-    if (f != mp.end())
-        ast_rec->annotation = "Hypothesis " + to_string(f->second);
-    return f != mp.end();
+    reader_impl rdr;
+    attach(rdr, begin, end);
+    parser prs(rdr, pool);
+    unordered_map<string_view, ast_expr_ptr> seen;
+
+    while (!eof(rdr))
+    {
+        char const* line = rdr.read_left;
+        auto nl = static_cast<char const*>(memchr(line, '\n', end - line));
+        if (nl == nullptr)
+        {
+            lines.push_back(parse_expr(prs));
+            continue;
+        }
+
+        string_view text(line, nl - line);
+        auto it = seen.find(text);
+        if (it != seen.end())
+        {
+            // what parse_expr() would consume: the line and one blank line after it
+            rdr.read_left = nl + 1;
+            if (rdr.read_left != end && *rdr.read_left == '\n')
+                ++rdr.read_left;
+            lines.push_back(it->second);
+            continue;
+        }
+
+        lines.push_back(parse_expr(prs));
+        if (rdr.read_left == nl + 1 || rdr.read_left == nl + 2)
+            seen.emplace(text, lines.back());
+    }
 }
 
-void mark_dependencies(ast_record* ast_rec)
+// Parses the lines of a mapped input, a chunk per core. Chunks are cut at
+// line starts and get pools of their own, so workers share nothing; the
+// checker compares formulas from different chunks by hash only.
+vector<ast_expr_ptr> parse_lines(char const* begin,
+                                 char const* end,
+                                 vector<unique_ptr<ast_pool>>& pools)
 {
-    ast_rec->was_used_to_prove = true;
-    if (ast_rec->modus_ponens_deps)
+    enum
+    {
+        min_chunk = 1u << 20
+    };
+
+    size_t chunks = min<size_t>(max(thread::hardware_concurrency(), 1u),
+                                (end - begin) / min_chunk + 1);
+    vector<char const*> bounds{begin};
+    for (size_t i = 1; i < chunks; ++i)
     {
-        mark_dependencies(ast_rec->modus_ponens_deps->first);
-        mark_dependencies(ast_rec->modus_ponens_deps->second);
+        char const* p = max(bounds.back(), begin + (end - begin) / chunks * i);
+        p = find(p, end, '\n');
+        // a blank line belongs to the line before it, see reset()
+        p = find_if(p, end, [] (char c) { return c != '\n'; });
+        bounds.push_back(p);
     }
+    bounds.push_back(end);
+
+    vector<vector<ast_expr_ptr>> lines(chunks);
+    vector<thread> workers;
+    for (size_t i = 0; i < chunks; ++i)
+    {
+        pools.push_back(make_unique<ast_pool>());
+        workers.emplace_back(parse_chunk, bounds[i], bounds[i + 1],
+                             ref(*pools.back()), ref(lines[i]));
+    }
+    for (auto& worker : workers)
+        worker.join();
+
+    vector<ast_expr_ptr> result;
+    for (auto& chunk : lines)
+        result.insert(result.end(), chunk.begin(), chunk.end());
+    return result;
 }
 
-using all_ast_trees_t = vector<unique_ptr<ast_record>>;
-using hash_to_record_t = unordered_map<hash_t, ast_record*, hash_t_hash>;
-using ast_set_by_hash_t = unordered_map<hash_t, unordered_map<hash_t, ast_record*, hash_t_hash>, hash_t_hash>;
-using id_by_hash_t = unordered_map<hash_t, size_t, hash_t_hash>;
+// What a line is by itself, whatever its place in the proof
+struct line_class
+{
+    size_t  hypothesis = 0; // see hypotesis_number()
+    int     scheme = 0;     // see axiom_scheme()
+};
+
+// Threads a slice pass may use
+static size_t slice_threads = max(thread::hardware_concurrency(), 1u);
 
-int main()
+// Number of slices to split n items into: one per core, none shorter than
+// min_slice
+size_t slices_for(size_t n, size_t min_slice)
 {
-    reader_impl             rdr;
-    all_ast_trees_t         all_asts;
-    vector<ast_record*>     expressions_order;
-    id_by_hash_t            hypotheses;
-    vector<ast_expression*> hypotheses_order; // TODO: ast_expr* -> ast_record*
-    hash_to_record_t        proven_by_hash;
-    ast_set_by_hash_t       proven_impl_by_right_subtree_hash;
-    ast_expr_ptr            result;
+    return min<size_t>(slice_threads, n / min_slice + 1);
+}
+
+// Runs work(slice, begin, end) over consecutive slices of [0, n), each on
+// a thread of its own; the calling thread takes slice 0
+template<typename Work>
+void run_slices(size_t slices, size_t n, Work const& work)
+{
+    auto bound = [n, slices] (size_t i) { return i == slices ? n : n / slices * i; };
+    vector<thread> workers;
+    for (size_t i = 1; i < slices; ++i)
+        workers.emplace_back([&work, &bound, i] { work(i, bound(i), bound(i + 1)); });
+    work(0, bound(0), bound(1));
+    for (auto& worker : workers)
+        worker.join();
+}
+
+// Classifies every line, a slice of them per core. Only modus ponens
+// depends on the lines before, so that is all the sequential pass is left
+// with. The indices are only read here.
+vector<line_class> classify_lines(vector<ast_expr_ptr> const& lines,
+                                  id_by_hash_t const& hypotheses,
+                                  vector<ast_expr_ptr> const& hypotheses_order)
+{
+    enum
+    {
+        min_slice = 1u << 14
+    };
+
+    vector<line_class> result(lines.size());
+    run_slices(slices_for(lines.size(), min_slice), lines.size(),
+               [&] (size_t, size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            result[i].hypothesis = hypotesis_number(lines[i], hypotheses, hypotheses_order);
+            if (result[i].hypothesis == 0)
+                result[i].scheme = axiom_scheme(lines[i]);
+        }
+    });
+    return result;
+}
+
+// 1-based number of the first line that follows from no lines before it,
+// 0 if every line does. Line i follows by modus ponens if some A->B and A
+// both occur before it, B being its formula; only the first occurrence of
+// each formula matters for that. So once those are known every line is
+// checked by itself, a slice of them per core, and the verdict is the same
+// as checking them in order. Formulas are compared by hash.
+size_t first_invalid_line(vector<ast_expr_ptr> const& lines,
+                          vector<line_class> const& classes)
+{
+    enum
+    {
+        min_slice = 1u << 14
+    };
+
+    using line_by_hash_t = hash_index<uint32_t>;
+    size_t const slices = slices_for(lines.size(), min_slice);
+    vector<line_by_hash_t> local(slices);
+
+    // Builds one index from the slices' ones, keeping the least line
+    auto merge = [&local] ()
+    {
+        line_by_hash_t result = move(local[0]);
+        for (size_t s = 1; s < local.size(); ++s)
+        {
+            local[s].for_each([&result] (pair<hash_t, uint32_t> const& e)
+            {
+                auto ins = result.insert(e);
+                if (!ins.second && ins.first->second > e.second)
+                    ins.first->second = e.second;
+            });
+            local[s] = line_by_hash_t();
+        }
+        return result;
+    };
+
+    run_slices(slices, lines.size(), [&] (size_t s, size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+            local[s].insert({lines[i]->hashcode, static_cast<uint32_t>(i)});
+    });
+    line_by_hash_t const first = merge();
+
+    // the line after which each consequent follows by modus ponens
+    local.assign(slices, line_by_hash_t());
+    run_slices(slices, lines.size(), [&] (size_t s, size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            ast_expr_ptr const ptr = lines[i];
+            if (!is_op(ptr, operation_type::IMPL)
+             || first.find(ptr->hashcode)->second != i)
+                continue;
+
+            auto premise = first.find(subtree(ptr, 0)->hashcode);
+            if (premise == first.end())
+                continue;
+
+            uint32_t at = max(static_cast<uint32_t>(i), premise->second);
+            auto ins = local[s].insert({subtree(ptr, 1)->hashcode, at});
+            if (!ins.second && ins.first->second > at)
+                ins.first->second = at;
+        }
+    });
+    line_by_hash_t const derivable = merge();
 
+    vector<size_t> invalid(slices, 0);
+    run_slices(slices, lines.size(), [&] (size_t s, size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            if (classes[i].hypothesis != 0 || classes[i].scheme != 0)
+                continue;
+
+            auto mp = derivable.find(lines[i]->hashcode);
+            if (mp == derivable.end() || mp->second >= i)
+            {
+                invalid[s] = i + 1;
+                return;
+            }
+        }
+    });
+
+    auto it = find_if(invalid.begin(), invalid.end(), [] (size_t i) { return i != 0; });
+    return it == invalid.end() ? 0 : *it;
+}
+
+// Reads the hypotheses and the goal of a text proof
+void read_header(parser& prs, bin_proof& proof)
+{
+    reader_impl& rdr = prs.rdr;
     assert(!eof(rdr));
-    size_t id = 1;
     if (!goes_next(rdr, "|-"))
     {
         while (true)
         {
-            auto expr = parse_expr(rdr);
-            auto* ptr = expr.get();
-            hypotheses_order.push_back(ptr);
-            auto ins = hypotheses.insert({ptr->hashcode, id++});
-            assert(ins.second);
-            all_asts.push_back(make_unique<ast_record>(move(expr)));
+            proof.hypotheses.push_back(parse_expr(prs));
 
             if (*rdr.read_left != ',')
                 break;
@@ -220,123 +610,499 @@ int main()
 
     assert(goes_next(rdr, "|-"));
     rdr.read_left += 2;
-    result = parse_expr(rdr);
+    proof.goal = parse_expr(prs);
+}
 
-    id = 0;
-    while (!eof(rdr))
+// Reads a text or a binary proof, returns whether it was binary
+bool read_proof(parser& prs,
+                vector<unique_ptr<ast_pool>>& chunk_pools,
+                bin_proof& proof)
+{
+    reader_impl& rdr = prs.rdr;
+    if (fill(rdr, 4) && is_bin_proof(rdr.read_left, rdr.read_right))
+    {
+        string data;
+        if (!rdr.mapped)
+            data = read_rest(rdr);
+        bool ok = rdr.mapped ? read_bin_proof(rdr.read_left, rdr.read_right, prs.pool, proof)
+                             : read_bin_proof(data.data(), data.data() + data.size(), prs.pool, proof);
+        if (!ok)
+        {
+            cout << "Malformed binary proof" << endl;
+            exit(0);
+        }
+        return true;
+    }
+
+    read_header(prs, proof);
+    if (rdr.mapped)
+    {
+        proof.lines = parse_lines(rdr.read_left, rdr.read_right, chunk_pools);
+    } else
+    {
+        while (!eof(rdr))
+            proof.lines.push_back(parse_expr(prs));
+    }
+    return false;
+}
+
+id_by_hash_t index_hypotheses(bin_proof const& proof)
+{
+    id_by_hash_t result;
+    for (size_t i = 0; i < proof.hypotheses.size(); ++i)
+    {
+        auto ins = result.insert({proof.hypotheses[i]->hashcode, i + 1});
+        assert(ins.second);
+    }
+    return result;
+}
+
+// What --check keeps of a proof: the hashes of the formulas proven so far
+// and of the implications still waiting for their antecedent, nothing of
+// the formulas themselves. Lines are compared by hash only.
+class line_checker
+{
+public:
+    // Whether the line follows from the ones added before it
+    bool add(ast_expr_ptr line, line_class const& cls)
+    {
+        if (cls.hypothesis == 0 && cls.scheme == 0 && !derivable.count(line->hashcode))
+            return false;
+
+        last = line->hashcode;
+        if (!proven.insert({line->hashcode, true}).second)
+            return true;
+
+        auto waiting = pending.find(line->hashcode);
+        if (waiting != pending.end())
+        {
+            for (auto const& consequent : waiting->second)
+                derivable.insert({consequent, true});
+            vector<hash_t>().swap(waiting->second);
+        }
+
+        if (is_op(line, operation_type::IMPL))
+        {
+            if (proven.count(subtree(line, 0)->hashcode))
+                derivable.insert({subtree(line, 1)->hashcode, true});
+            else
+                pending[subtree(line, 0)->hashcode].push_back(subtree(line, 1)->hashcode);
+        }
+        return true;
+    }
+
+    // Whether the last line added is the goal
+    bool proves(ast_expr_ptr goal) const
     {
-    	id++;
-        auto expr = parse_expr(rdr);
-        auto* ptr = expr.get();
-        auto ast_record_ptr = make_unique<ast_record>(move(expr));
+        return last && *last == goal->hashcode;
+    }
+
+private:
+    hash_index<bool>            proven;
+    hash_index<bool>            derivable;  // by modus ponens from proven lines
+    hash_index<vector<hash_t>>  pending;    // consequents by antecedent
+    optional<hash_t>            last;
+};
+
+// check_proof(): the last line isn't the goal
+static size_t const bad_goal = SIZE_MAX;
+
+// --check: verifies the proof while reading it, a block of lines at a
+// time. A block is parsed into a pool of its own that is cleared once its
+// lines are classified and checked, so memory doesn't grow with the input,
+// only with the number of distinct formulas proven. Returns 0 if the proof
+// is correct, else the 1-based line that doesn't follow or bad_goal.
+size_t check_proof(int fd)
+{
+    enum
+    {
+        block_size = 1u << 20
+    };
+
+    reader_impl rdr;
+    rdr.fd = fd;
+    ast_pool    pool;
+    ast_pool    lines_pool;
+    parser      prs(rdr, pool);
+    bin_proof   proof;
+    line_checker checker;
+    size_t      id = 0;
 
-        ast_record* ast_rec = ast_record_ptr.get();
-        all_asts.push_back(move(ast_record_ptr));
+    // Whether every line of a block follows
+    auto check = [&] (vector<ast_expr_ptr> const& lines, id_by_hash_t const& hypotheses)
+    {
+        auto const classes = classify_lines(lines, hypotheses, proof.hypotheses);
+        for (size_t i = 0; i < lines.size(); ++i)
+        {
+            ++id;
+            if (!checker.add(lines[i], classes[i]))
+                return false;
+        }
+        return true;
+    };
 
-        expressions_order.push_back(ast_rec);
+    if (fill(rdr, 4) && is_bin_proof(rdr.read_left, rdr.read_right))
+    {
+        // its formulas come before its lines, so a binary proof is read whole
+        vector<unique_ptr<ast_pool>> no_pools;
+        read_proof(prs, no_pools, proof);
+        if (!check(proof.lines, index_hypotheses(proof)))
+            return id;
+    } else
+    {
+        read_header(prs, proof);
+        auto const hypotheses = index_hypotheses(proof);
 
-        if (!check_if_hypotesis(ast_rec, hypotheses)
-         && !check_if_axiom(ast_rec))
+        string block(rdr.read_left, rdr.read_right);
+        vector<ast_expr_ptr> lines;
+        for (bool more = true; more; )
         {
-            bool modus_ponens_found = false;
-            auto it = proven_impl_by_right_subtree_hash.find(ast_rec->hashcode);
-            if (it != proven_impl_by_right_subtree_hash.end())
+            size_t const kept = block.size();
+            block.resize(max<size_t>(block_size, kept * 2)); // a line may be longer than a block
+            ssize_t cnt = read(fd, &block[kept], block.size() - kept);
+            if (cnt == -1)
             {
-                for (auto hash_and_parent : it->second)
-                {
-                    auto it2 = proven_by_hash.find(*hash_and_parent.second->l_hash);
-                    if (it2 == proven_by_hash.end()) continue;
-
-                    if (!modus_ponens_found)
-                    {
-                        ast_rec->modus_ponens_deps = make_pair(hash_and_parent.second, it2->second);
-                        ast_rec->mp_subtree_size = hash_and_parent.second->mp_subtree_size
-                                                 + it2->second->mp_subtree_size
-                                                 + 1;
-                        modus_ponens_found = true;
-                    } else
-                    {
-                        if (ast_rec->modus_ponens_deps->first->mp_subtree_size + ast_rec->modus_ponens_deps->second->mp_subtree_size
-                            > hash_and_parent.second->mp_subtree_size + it2->second->mp_subtree_size)
-                        {
-                            ast_rec->modus_ponens_deps = make_pair(hash_and_parent.second, it2->second);
-                            ast_rec->mp_subtree_size = hash_and_parent.second->mp_subtree_size
-                                                     + it2->second->mp_subtree_size
-                                                     + 1;
-                        }
-                    }
-                }
+                printf("Read failed! Error: %s\n", strerror(errno));
+                exit(0);
             }
+            block.resize(kept + cnt);
+            more = cnt != 0;
 
-            if (!modus_ponens_found)
+            // the last line may be incomplete, it waits for the next read;
+            // a blank line belongs to the line before it, see parse_lines()
+            char const* begin = block.data();
+            char const* end = begin + block.size();
+            char const* cut = end;
+            if (more)
             {
-                cout << "Proof is incorrect" << endl;
-		cout << "Line: " << id << endl;
-                return 0;
+                while (cut != begin && !(cut[-1] == '\n' && cut != end && *cut != '\n'))
+                    --cut;
+                if (cut == begin)
+                    continue;
             }
+
+            lines.clear();
+            lines_pool.clear();
+            parse_chunk(begin, cut, lines_pool, lines);
+            if (!check(lines, hypotheses))
+                return id;
+            block.erase(0, cut - begin);
         }
+    }
+
+    return checker.proves(proof.goal) ? 0 : bad_goal;
+}
+
+void print_verdict(size_t bad_line)
+{
+    if (bad_line == 0)
+    {
+        cout << "Proof is correct" << endl;
+        return;
+    }
 
-        bool inserted = false;
-        auto it = proven_by_hash.find(ptr->hashcode);
-        if (it == proven_by_hash.end()
-         || it->second->mp_subtree_size > ast_rec->mp_subtree_size)
+    cout << "Proof is incorrect" << endl;
+    if (bad_line == bad_goal)
+        cout << "Incorrect last expression" << endl;
+    else
+        cout << "Line: " << bad_line << endl;
+}
+
+// --batch: checks many proofs as check_proof() does, a proof per core at
+// a time, and prints a verdict per file in the order given. Workers share
+// nothing mutable: each proof gets its own pools and indices, and axiom
+// schemes are matched by the decision tree compiled once for the run,
+// built in or loaded by --axioms.
+void check_batch(vector<string> const& paths)
+{
+    static size_t const cant_open = SIZE_MAX - 1;
+
+    vector<size_t> verdicts(paths.size());
+    atomic<size_t> next{0};
+    auto work = [&] ()
+    {
+        for (size_t i; (i = next++) < paths.size(); )
         {
-            inserted = true;
-            proven_by_hash.insert(it, {ptr->hashcode, ast_rec});
+            int fd = open(paths[i].c_str(), O_RDONLY);
+            if (fd == -1)
+            {
+                verdicts[i] = cant_open;
+                continue;
+            }
+            verdicts[i] = check_proof(fd);
+            close(fd);
         }
+    };
+
+    // a proof per core already, the slice passes of one proof get no more
+    size_t const workers_cnt = min<size_t>(slice_threads, paths.size());
+    slice_threads = 1;
+    vector<thread> workers;
+    for (size_t i = 1; i < workers_cnt; ++i)
+        workers.emplace_back(work);
+    work();
+    for (auto& worker : workers)
+        worker.join();
+
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        cout << paths[i] << ": ";
+        if (verdicts[i] == cant_open)
+            cout << "Can't open" << "\n";
+        else if (verdicts[i] == 0)
+            cout << "Proof is correct" << "\n";
+        else if (verdicts[i] == bad_goal)
+            cout << "Proof is incorrect, incorrect last expression" << "\n";
+        else
+            cout << "Proof is incorrect, line " << verdicts[i] << "\n";
+    }
+    cout.flush();
+}
+
+void print_header(bin_proof const& proof)
+{
+    if (proof.hypotheses.size())
+        cout << *proof.hypotheses[0];
+    for (size_t i = 1; i < proof.hypotheses.size(); ++i)
+        cout << ", " << *proof.hypotheses[i];
+    cout << " |- " << *proof.goal << endl;
+}
+
+// ids are the lines' numbers in the output
+bin_proof::justification justify(line_table const& lines,
+                                 vector<uint32_t> const& ids,
+                                 uint32_t i)
+{
+    using kind = bin_proof::just_kind;
+    switch (lines.kinds[i])
+    {
+    case line_table::kind::HYPOTHESIS:
+        return {kind::HYPOTHESIS, lines.number[i]};
+    case line_table::kind::AXIOM:
+        return {kind::AXIOM, lines.number[i]};
+    default:
+        return {kind::MODUS_PONENS, ids[lines.impl[i]], ids[lines.premise[i]]};
+    }
+}
 
-        if (is_op(ptr, operation_type::IMPL))
+// Usage: main [--binary] [--convert] [--check] [--verify] [--minimize[=exact]]
+//             [--axioms file] [proof file]
+//        main --batch [--verify] [--axioms file] [proof files]
+//   --binary   print the minimized proof in the binary format
+//   --convert  don't check, just print the proof in the other format
+//   --check    only tell whether the proof is correct, in bounded memory,
+//              see check_proof(); --verify applies to hypotheses only
+//   --verify   don't trust hash equality alone
+//   --minimize print a proof needing fewer lines where the input allows,
+//              see minimize_greedy(); --minimize=exact finds the fewest,
+//              see minimize_exact()
+//   --axioms   check against the schemes in file instead, see read_axioms(),
+//              e.g. "(A->B)->(A->!B)->!A"; metavariables are named like
+//              variables
+//   --batch    --check every proof file given, or listed one per line on
+//              stdin, on all cores; see check_batch()
+int main(int argc, char* argv[])
+{
+    reader_impl             rdr;
+    ast_pool                pool;
+    vector<unique_ptr<ast_pool>> chunk_pools;
+    hash_to_line_t          proven_by_hash;
+    mp_index<uint32_t>      modus_ponens;
+    bin_proof               proof;
+    bool                    binary_output = false;
+    bool                    convert = false;
+    bool                    check_only = false;
+    bool                    batch = false;
+    vector<string>          batch_paths;
+    minimize_mode           minimize = minimize_mode::NONE;
+    char const*             path = nullptr;
+    unique_ptr<axiom_system> axioms;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (argv[i] == string("--binary"))
+            binary_output = true;
+        else if (argv[i] == string("--convert"))
+            convert = true;
+        else if (argv[i] == string("--check"))
+            check_only = true;
+        else if (argv[i] == string("--batch"))
+            batch = true;
+        else if (argv[i] == string("--verify"))
+            verify_hits = true;
+        else if (argv[i] == string("--minimize"))
+            minimize = minimize_mode::GREEDY;
+        else if (argv[i] == string("--minimize=exact"))
+            minimize = minimize_mode::EXACT;
+        else if (argv[i] == string("--axioms") && i + 1 < argc)
+            axioms = read_axioms(argv[++i]);
+        else if (batch)
+            batch_paths.push_back(argv[i]);
+        else
+            path = argv[i];
+    }
+
+    if (axioms && !same_axioms(*axioms, classical_axioms))
+        loaded_axioms = axioms.get();
+
+    if (batch)
+    {
+        if (batch_paths.empty())
+            for (string line; getline(cin, line); )
+                if (!line.empty())
+                    batch_paths.push_back(line);
+        check_batch(batch_paths);
+        return 0;
+    }
+
+    int fd = fileno(stdin);
+    if (path != nullptr && (fd = open(path, O_RDONLY)) == -1)
+    {
+        cout << "Can't open " << path << endl;
+        return 0;
+    }
+    if (check_only)
+    {
+        print_verdict(check_proof(fd));
+        return 0;
+    }
+    map_input(rdr, fd);
+
+    parser prs(rdr, pool);
+    bool const binary_input = read_proof(prs, chunk_pools, proof);
+    if (convert)
+    {
+        if (!binary_input)
         {
-            inserted = true;
-            proven_impl_by_right_subtree_hash[subtree(ptr, 1)->hashcode].insert({ptr->hashcode, ast_rec});
-            ast_rec->l_hash = subtree(ptr, 0)->hashcode;
+            write_bin_proof(cout, proof);
+            return 0;
         }
 
+        print_header(proof);
+        for (auto line : proof.lines)
+            cout << *line << "\n";
+        return 0;
+    }
+
+    auto const hypotheses = index_hypotheses(proof);
+    auto const classes = classify_lines(proof.lines, hypotheses, proof.hypotheses);
+    if (size_t line = first_invalid_line(proof.lines, classes))
+    {
+        cout << "Proof is incorrect" << endl;
+        cout << "Line: " << line << endl;
+        return 0;
+    }
+    line_table lines(move(proof.lines));
+
+    for (uint32_t i = 0; i < lines.size(); ++i)
+    {
+        ast_expr_ptr const ptr = lines.formula[i];
+        auto const& cls = classes[i];
+        if (cls.hypothesis != 0)
+        {
+            lines.kinds[i] = line_table::kind::HYPOTHESIS;
+            lines.number[i] = cls.hypothesis;
+        } else if (cls.scheme != 0)
         {
-            stringstream asts;
-            asts << *ptr;
-            ast_rec->ast = asts.str();
+            lines.kinds[i] = line_table::kind::AXIOM;
+            lines.number[i] = cls.scheme;
+        } else
+        {
+            auto mp = modus_ponens.find(ptr->hashcode);
+            bool modus_ponens_found = mp != nullptr
+                && same_formula(subtree(lines.formula[mp->impl], 1), ptr)
+                && same_formula(subtree(lines.formula[mp->impl], 0), lines.formula[mp->premise]);
+            if (!modus_ponens_found)
+            {
+                cout << "Proof is incorrect" << endl;
+		cout << "Line: " << i + 1 << endl;
+                return 0;
+            }
+
+            lines.kinds[i] = line_table::kind::MODUS_PONENS;
+            lines.impl[i] = mp->impl;
+            lines.premise[i] = mp->premise;
+            lines.mp_subtree_size[i] = mp_cost(mp->cost, 1);
         }
 
-        if (!inserted)
+        if (proven_by_hash.insert({ptr->hashcode, i}).second)
         {
-	    // uncomment  to get productive code
-	    // comment    for convenient checking
-            // expressions_order.pop_back();
+            modus_ponens.proven(ptr->hashcode, i, lines.mp_subtree_size[i]);
+            if (is_op(ptr, operation_type::IMPL))
+            {
+                auto antecedent = subtree(ptr, 0)->hashcode;
+                auto consequent = subtree(ptr, 1)->hashcode;
+                auto premise = proven_by_hash.find(antecedent);
+                if (premise != proven_by_hash.end())
+                    modus_ponens.offer(consequent, i, premise->second,
+                                       mp_cost(lines.mp_subtree_size[i], lines.mp_subtree_size[premise->second]));
+                else
+                    modus_ponens.implication(i, lines.mp_subtree_size[i], antecedent, consequent);
+            }
         }
     }
 
-    auto it = proven_by_hash.find(result->hashcode);
+    auto it = proven_by_hash.find(proof.goal->hashcode);
     if (it == proven_by_hash.end()
-     || expressions_order.back()->hashcode != result->hashcode)
+     || lines.size() == 0
+     || lines.formula.back()->hashcode != proof.goal->hashcode
+     || !same_formula(lines.formula.back(), proof.goal)
+     || !same_formula(lines.formula[it->second], proof.goal))
     {
         cout << "Proof is incorrect" << endl;
 	cout << "Incorrect last expression" << endl;
         return 0;
     }
 
-    mark_dependencies(it->second);
+    uint32_t goal = it->second;
+    if (minimize != minimize_mode::NONE)
+    {
+        auto const choices = mp_choices(lines, proven_by_hash);
+        if (minimize == minimize_mode::GREEDY)
+            minimize_greedy(lines, choices, goal);
+        else if (!minimize_exact(lines, choices, proven_by_hash, goal))
+            cerr << "Search cut short, the proof may not be the shortest" << endl;
+    }
+
+    auto const used = mark_dependencies(lines, goal);
+    vector<uint32_t> ids(lines.size()); // numbers in the output, given in the sweep below
 
-    if (hypotheses_order.size())
-        cout << *hypotheses_order[0];
-    for (size_t i = 1; i < hypotheses_order.size(); ++i)
-        cout << ", " << *hypotheses_order[i];
-    cout << " |- " << *result << endl;
+    bin_proof minimized;
+    if (binary_output)
+    {
+        minimized.hypotheses = proof.hypotheses;
+        minimized.goal = proof.goal;
+    } else
+    {
+        print_header(proof);
+    }
 
-    id = 0;
-    for (auto* ast : expressions_order)
+    uint32_t id = 0;
+    for (uint32_t i = 0; i < lines.size(); ++i)
     {
-        if (!ast->was_used_to_prove) continue;
-        ast->id = ++id;
-        if (ast->modus_ponens_deps)
+        if (!used[i]) continue;
+        ids[i] = ++id;
+        if (binary_output)
         {
-            cout << "[" << id << ". M.P. " << ast->modus_ponens_deps->first->id << ", " << ast->modus_ponens_deps->second->id << "] " << get<string>(ast->ast) << endl;
+            minimized.lines.push_back(lines.formula[i]);
+            minimized.justifications.push_back(justify(lines, ids, i));
+            continue;
         }
-        else
+        switch (lines.kinds[i])
         {
-            cout << "[" << id << ". " << *ast->annotation << "] " << get<string>(ast->ast) << endl;
+        case line_table::kind::HYPOTHESIS:
+            cout << "[" << id << ". Hypothesis " << lines.number[i] << "] " << *lines.formula[i] << "\n";
+            break;
+        case line_table::kind::AXIOM:
+            cout << "[" << id << ". Ax. sch. " << lines.number[i] << "] " << *lines.formula[i] << "\n";
+            break;
+        case line_table::kind::MODUS_PONENS:
+            cout << "[" << id << ". M.P. " << ids[lines.impl[i]] << ", " << ids[lines.premise[i]] << "] " << *lines.formula[i] << "\n";
+            break;
         }
     }
 
+    if (binary_output)
+        write_bin_proof(cout, minimized);
     return 0;
 }
@@ -0,0 +1,605 @@
+#ifndef AXIOMS_H
+#define AXIOMS_H
+
+#include "parsex.h"
+
+#include <cstdint>
+#include <string_view>
+
+// Axiom schemes are written as formulas over metavariables, "A->B->A",
+// and compiled at compile time into one decision tree over all the
+// schemes, which match_axiom() unrolls into code.
+//
+// Nodes are numbered heap-style: the root is 1, the operands of p are 2p
+// and 2p + 1, a negation's operand is 2p. A scheme is the operation each
+// of its inner positions must hold, and equality tests: the subformulas
+// at p and q are the same node, which the pool makes structural equality.
+// A metavariable binds where it occurs first; later occurrences become
+// equality tests.
+
+enum
+{
+    scheme_depth = 6,                           // levels a scheme may span
+    scheme_positions = 1u << scheme_depth,      // position 0 is unused
+    scheme_leaves = scheme_positions / 2,
+    max_schemes = 64,
+    max_decisions = 2048,
+    node_tags = 6                               // see node_tag()
+};
+
+enum : uint8_t
+{
+    no_node_tag = 0,    // operation_type + 1 tags an operation
+    var_node_tag = 5
+};
+
+struct axiom_scheme
+{
+    struct eq_test
+    {
+        uint8_t pos = 0;
+        uint8_t same_as = 0;
+    };
+
+    uint64_t    ops = 0;            // bit p: there is an operation at p
+    uint8_t     tags[scheme_positions] = {};    // its node_tag()
+    eq_test     eqs[scheme_leaves] = {};
+    uint8_t     eqs_cnt = 0;
+    char const* error = nullptr;
+};
+
+// Recursive descent over the formula grammar: ! binds tightest, then &,
+// then |, both left-associative, then right-associative ->. Usable in
+// constant expressions.
+struct scheme_compiler
+{
+    struct node
+    {
+        int op = -1;    // operation_type, -1 for a metavariable
+        int meta = 0;
+        int lhs = -1;
+        int rhs = -1;
+    };
+
+    std::string_view    text;
+    size_t              cur = 0;
+    node                nodes[scheme_positions] = {};
+    int                 nodes_cnt = 0;
+    std::string_view    metas[scheme_positions] = {};
+    uint8_t             meta_pos[scheme_positions] = {};
+    int                 metas_cnt = 0;
+    axiom_scheme        result;
+
+    constexpr explicit scheme_compiler(std::string_view text)
+        : text(text)
+    {}
+
+    constexpr int fail(char const* error)
+    {
+        if (result.error == nullptr)
+            result.error = error;
+        return -1;
+    }
+
+    constexpr void skip_ws()
+    {
+        while (cur < text.size()
+            && (text[cur] == ' ' || text[cur] == '\t' || text[cur] == '\r'))
+            ++cur;
+    }
+
+    constexpr bool eat(std::string_view token)
+    {
+        skip_ws();
+        if (text.substr(cur, token.size()) != token)
+            return false;
+        cur += token.size();
+        return true;
+    }
+
+    constexpr int make(int op, int meta, int lhs, int rhs)
+    {
+        bool const binary = op >= 0 && op != static_cast<int>(operation_type::NEG);
+        if ((op >= 0 && lhs < 0) || (binary && rhs < 0))
+            return -1;  // an operand failed to parse, the error is set
+        if (nodes_cnt == scheme_positions)
+            return fail("scheme too long");
+        nodes[nodes_cnt] = {op, meta, lhs, rhs};
+        return nodes_cnt++;
+    }
+
+    constexpr int meta(std::string_view name)
+    {
+        for (int i = 0; i < metas_cnt; ++i)
+            if (metas[i] == name)
+                return make(-1, i, -1, -1);
+        if (metas_cnt == scheme_positions)
+            return fail("too many metavariables");
+        metas[metas_cnt] = name;
+        return make(-1, metas_cnt++, -1, -1);
+    }
+
+    constexpr int parse_unary()
+    {
+        if (eat("!"))
+            return make(static_cast<int>(operation_type::NEG), 0, parse_unary(), -1);
+        if (eat("("))
+        {
+            int inner = parse_impl();
+            if (inner >= 0 && !eat(")"))
+                return fail("expected ')'");
+            return inner;
+        }
+
+        skip_ws();
+        size_t begin = cur;
+        if (cur < text.size() && text[cur] >= 'A' && text[cur] <= 'Z')
+            while (cur < text.size()
+                && ((text[cur] >= 'A' && text[cur] <= 'Z')
+                 || (text[cur] >= '0' && text[cur] <= '9')
+                 || text[cur] == '\''))
+                ++cur;
+        if (begin == cur)
+            return fail("expected a metavariable");
+        return meta(text.substr(begin, cur - begin));
+    }
+
+    constexpr int parse_binary(operation_type op, std::string_view token)
+    {
+        bool conj = op == operation_type::CONJ;
+        int lhs = conj ? parse_unary() : parse_binary(operation_type::CONJ, "&");
+        while (lhs >= 0 && eat(token))
+            lhs = make(static_cast<int>(op), 0, lhs,
+                       conj ? parse_unary() : parse_binary(operation_type::CONJ, "&"));
+        return lhs;
+    }
+
+    constexpr int parse_impl()
+    {
+        int lhs = parse_binary(operation_type::DISJ, "|");
+        if (lhs >= 0 && eat("->"))
+            return make(static_cast<int>(operation_type::IMPL), 0, lhs, parse_impl());
+        return lhs;
+    }
+
+    constexpr void place(int n, size_t pos)
+    {
+        if (pos >= scheme_positions)
+        {
+            fail("scheme too deep");
+            return;
+        }
+        auto& nd = nodes[n];
+        if (nd.op < 0)
+        {
+            if (meta_pos[nd.meta] == 0)
+                meta_pos[nd.meta] = static_cast<uint8_t>(pos);
+            else
+                result.eqs[result.eqs_cnt++] = {static_cast<uint8_t>(pos), meta_pos[nd.meta]};
+            return;
+        }
+
+        result.ops |= uint64_t(1) << pos;
+        result.tags[pos] = static_cast<uint8_t>(nd.op + 1);
+        place(nd.lhs, 2 * pos);
+        if (nd.rhs >= 0)
+            place(nd.rhs, 2 * pos + 1);
+    }
+
+    constexpr axiom_scheme compile()
+    {
+        int root = parse_impl();
+        skip_ws();
+        if (root >= 0 && cur != text.size())
+            root = fail("unexpected character");
+        if (root < 0)
+        {
+            fail("malformed scheme");
+            return result;
+        }
+        if (nodes[root].op < 0)
+        {
+            fail("a scheme can't be a bare metavariable");
+            return result;
+        }
+        place(root, 1);
+        return result;
+    }
+};
+
+constexpr axiom_scheme compile_scheme(std::string_view text)
+{
+    return scheme_compiler(text).compile();
+}
+
+// Schemes in the order they are tried, and one decision tree over all of
+// them. A tree node tests the tag at a position, branching on it, or
+// whether two positions hold the same node, or is a leaf naming the scheme
+// matched. The tree follows the tests of the first scheme still possible,
+// equalities as soon as both nodes are at hand since they fail cheaply;
+// what a test tells about the other schemes prunes or completes them as
+// well, so no test is made twice on a path. Paths that reach the same
+// schemes knowing the same about them share the subtree, so the tree is
+// really a DAG. Node 0 is the leaf matching nothing.
+struct axiom_system
+{
+    struct decision
+    {
+        enum kind_t : uint8_t
+        {
+            LEAF,
+            TAG,    // next by the tag at pos
+            SAME    // next[1] if pos and same_as hold the same node, else next[0]
+        };
+
+        kind_t      kind = LEAF;
+        uint8_t     pos = 0;
+        uint8_t     same_as = 0;
+        uint8_t     scheme = 0;     // leaves: 1-based, 0 if none
+        uint16_t    next[node_tags] = {};
+    };
+
+    axiom_scheme    schemes[max_schemes] = {};
+    size_t          schemes_cnt = 0;
+    decision        tree[max_decisions] = {};
+    size_t          tree_cnt = 1;       // 0 if the tree didn't fit
+    char const*     error = nullptr;
+
+    // Returns whether there was room for the scheme
+    constexpr bool add(std::string_view text)
+    {
+        if (schemes_cnt == max_schemes)
+            return false;
+        schemes[schemes_cnt] = compile_scheme(text);
+        if (error == nullptr)
+            error = schemes[schemes_cnt].error;
+        ++schemes_cnt;
+        return true;
+    }
+
+    // Builds the tree once every scheme is added. If it takes more than
+    // max_decisions nodes, tree_cnt is left 0 and match_axiom() tries the
+    // schemes one at a time instead.
+    constexpr void compile()
+    {
+        uint64_t all = 0;
+        for (size_t i = 0; i < schemes_cnt; ++i)
+            if (schemes[i].error == nullptr)
+                all |= uint64_t(1) << i;
+        tree_cnt = 1;
+        grown memo;
+        grow(all, known{}, memo);
+        if (memo.overflow)
+            tree_cnt = 0;
+    }
+
+private:
+    // What the tests on a path have established
+    struct known
+    {
+        uint64_t                tags = 0;   // bit p: the tag at p
+        axiom_scheme::eq_test   same[2 * scheme_positions] = {};
+        size_t                  same_cnt = 0;
+    };
+
+    // The state each tree node was grown from, by node
+    struct grown
+    {
+        uint64_t    possible[max_decisions] = {};
+        known       k[max_decisions] = {};
+        bool        overflow = false;
+    };
+
+    static constexpr bool is_same(axiom_scheme::eq_test const& a,
+                                  axiom_scheme::eq_test const& b)
+    {
+        return (a.pos == b.pos && a.same_as == b.same_as)
+            || (a.pos == b.same_as && a.same_as == b.pos);
+    }
+
+    static constexpr bool has(axiom_scheme const& scheme,
+                              axiom_scheme::eq_test const& eq)
+    {
+        for (size_t i = 0; i < scheme.eqs_cnt; ++i)
+            if (is_same(scheme.eqs[i], eq))
+                return true;
+        return false;
+    }
+
+    static constexpr bool has(known const& k, axiom_scheme::eq_test const& eq)
+    {
+        for (size_t i = 0; i < k.same_cnt; ++i)
+            if (is_same(k.same[i], eq))
+                return true;
+        return false;
+    }
+
+    // What of k the tests of the schemes in possible can look at: tags at
+    // their operations and their equalities, the latter oriented and sorted
+    // so states reached in a different order compare equal
+    constexpr known relevant(uint64_t possible, known const& k) const
+    {
+        known result;
+        uint64_t ops = 0;
+        for (size_t j = 0; j < schemes_cnt; ++j)
+            if (possible >> j & 1)
+                ops |= schemes[j].ops;
+        result.tags = k.tags & ops;
+
+        for (size_t i = 0; i < k.same_cnt; ++i)
+        {
+            bool used = false;
+            for (size_t j = 0; j < schemes_cnt && !used; ++j)
+                used = (possible >> j & 1) && has(schemes[j], k.same[i]);
+            if (!used)
+                continue;
+
+            auto eq = k.same[i];
+            if (eq.pos > eq.same_as)
+                eq = {eq.same_as, eq.pos};
+            size_t at = result.same_cnt++;
+            for (; at > 0 && (result.same[at - 1].pos > eq.pos
+                           || (result.same[at - 1].pos == eq.pos
+                            && result.same[at - 1].same_as > eq.same_as)); --at)
+                result.same[at] = result.same[at - 1];
+            result.same[at] = eq;
+        }
+        return result;
+    }
+
+    static constexpr bool same_state(known const& a, known const& b)
+    {
+        if (a.tags != b.tags || a.same_cnt != b.same_cnt)
+            return false;
+        for (size_t i = 0; i < a.same_cnt; ++i)
+            if (a.same[i].pos != b.same[i].pos || a.same[i].same_as != b.same[i].same_as)
+                return false;
+        return true;
+    }
+
+    // Subtree deciding between the schemes still possible; grown once per
+    // state, memo holds the states seen
+    constexpr uint16_t grow(uint64_t possible, known const& path, grown& memo)
+    {
+        if (possible == 0 || memo.overflow)
+            return 0;
+
+        known const k = relevant(possible, path);
+        for (size_t i = 1; i < tree_cnt; ++i)
+            if (memo.possible[i] == possible && same_state(memo.k[i], k))
+                return static_cast<uint16_t>(i);
+        if (tree_cnt == max_decisions)
+        {
+            memo.overflow = true;
+            return 0;
+        }
+
+        size_t first = 0;
+        while (!(possible >> first & 1))
+            ++first;
+        auto const& scheme = schemes[first];
+        auto const at = static_cast<uint16_t>(tree_cnt++);
+        memo.possible[at] = possible;
+        memo.k[at] = k;
+
+        for (size_t i = 0; i < scheme.eqs_cnt; ++i)
+        {
+            auto const& eq = scheme.eqs[i];
+            if (has(k, eq)
+             || !(k.tags >> (eq.pos / 2) & 1)
+             || !(k.tags >> (eq.same_as / 2) & 1))
+                continue;
+
+            uint64_t differ = possible;
+            for (size_t j = 0; j < schemes_cnt; ++j)
+                if (has(schemes[j], eq))
+                    differ &= ~(uint64_t(1) << j);
+            known same = k;
+            same.same[same.same_cnt++] = eq;
+
+            tree[at].kind = decision::SAME;
+            tree[at].pos = eq.pos;
+            tree[at].same_as = eq.same_as;
+            tree[at].next[1] = grow(possible, same, memo);
+            tree[at].next[0] = grow(differ, k, memo);
+            return at;
+        }
+
+        uint64_t const untested = scheme.ops & ~k.tags;
+        if (untested == 0)
+        {
+            // every test of the first scheme passed, the others don't matter
+            tree[at].scheme = static_cast<uint8_t>(first + 1);
+            return at;
+        }
+
+        size_t pos = 0;
+        while (!(untested >> pos & 1))
+            ++pos;
+        known tagged = k;
+        tagged.tags |= uint64_t(1) << pos;
+
+        tree[at].kind = decision::TAG;
+        tree[at].pos = static_cast<uint8_t>(pos);
+        // a tested position always holds a node, no_node_tag can't come up
+        for (uint8_t tag = 1; tag < node_tags; ++tag)
+        {
+            uint64_t next = possible;
+            for (size_t j = 0; j < schemes_cnt; ++j)
+                if ((schemes[j].ops >> pos & 1) && schemes[j].tags[pos] != tag)
+                    next &= ~(uint64_t(1) << j);
+            tree[at].next[tag] = grow(next, tagged, memo);
+        }
+        return at;
+    }
+};
+
+// Whether the tree fit in max_decisions nodes only shows once it's grown,
+// match_axiom<>() checks that
+template<size_t N>
+constexpr axiom_system compile_axioms(char const* const (&texts)[N])
+{
+    static_assert(N <= max_schemes, "too many schemes");
+    axiom_system result;
+    for (auto text : texts)
+        result.add(text);
+    result.compile();
+    return result;
+}
+
+// Hilbert-style classical propositional calculus; 1 to 9 are intuitionistic
+constexpr char const* classical_schemes[] = {
+    "A->B->A",
+    "(A->B)->(A->B->C)->(A->C)",
+    "A->B->A&B",
+    "A&B->A",
+    "A&B->B",
+    "A->A|B",
+    "B->A|B",
+    "(A->C)->(B->C)->(A|B->C)",
+    "(A->B)->(A->!B)->!A",
+    "!!A->A",
+};
+
+constexpr axiom_system classical_axioms = compile_axioms(classical_schemes);
+static_assert(classical_axioms.error == nullptr, "malformed built-in scheme");
+
+static inline uint8_t node_tag(ast_expr_ptr ast)
+{
+    auto op = std::get_if<ast_expression::operation>(&ast->content);
+    return op != nullptr ? static_cast<uint8_t>(op->op_type) + 1 : var_node_tag;
+}
+
+// The tree of System unrolled into code, a function per tree node. A test
+// only looks at positions whose parent is an operation with an operand
+// there, known from the tests before it; positions are constants, so the
+// nodes stay in registers.
+template<axiom_system const& System, size_t At>
+static inline int match_from(ast_expr_ptr (&node)[scheme_positions])
+{
+    using decision = axiom_system::decision;
+    constexpr decision at = System.tree[At];
+
+    auto child = [&node] (size_t pos)
+    {
+        return std::get<ast_expression::operation>(node[pos / 2]->content).argv[pos % 2];
+    };
+
+    if constexpr (at.kind == decision::LEAF)
+    {
+        return at.scheme;
+    } else if constexpr (at.kind == decision::SAME)
+    {
+        if (child(at.pos) == child(at.same_as))
+            return match_from<System, at.next[1]>(node);
+        return match_from<System, at.next[0]>(node);
+    } else
+    {
+        if constexpr (at.pos != 1)
+            node[at.pos] = child(at.pos);
+        switch (node_tag(node[at.pos]))
+        {
+        case static_cast<uint8_t>(operation_type::NEG) + 1:
+            return match_from<System, at.next[static_cast<uint8_t>(operation_type::NEG) + 1]>(node);
+        case static_cast<uint8_t>(operation_type::CONJ) + 1:
+            return match_from<System, at.next[static_cast<uint8_t>(operation_type::CONJ) + 1]>(node);
+        case static_cast<uint8_t>(operation_type::DISJ) + 1:
+            return match_from<System, at.next[static_cast<uint8_t>(operation_type::DISJ) + 1]>(node);
+        case static_cast<uint8_t>(operation_type::IMPL) + 1:
+            return match_from<System, at.next[static_cast<uint8_t>(operation_type::IMPL) + 1]>(node);
+        default:
+            return match_from<System, at.next[var_node_tag]>(node);
+        }
+    }
+}
+
+// 1-based number of the first scheme of System ast is an instance of, 0 if
+// none
+template<axiom_system const& System>
+static inline int match_axiom(ast_expr_ptr ast)
+{
+    static_assert(System.tree_cnt != 0, "the decision tree takes more than max_decisions nodes");
+    ast_expr_ptr node[scheme_positions];
+    node[1] = ast;
+    return match_from<System, 1>(node);
+}
+
+// The same walk over a tree built at run time, for systems read from a
+// file; schemes are tried one at a time if the tree didn't fit
+static inline int match_axiom(axiom_system const& system, ast_expr_ptr ast)
+{
+    using decision = axiom_system::decision;
+
+    ast_expr_ptr node[scheme_positions];
+    node[1] = ast;
+    auto child = [&node] (size_t pos)
+    {
+        return std::get<ast_expression::operation>(node[pos / 2]->content).argv[pos % 2];
+    };
+
+    if (system.tree_cnt == 0)
+    {
+        for (size_t i = 0; i < system.schemes_cnt; ++i)
+        {
+            // operations in position order, so a parent is checked before
+            // its operands are looked up
+            auto const& scheme = system.schemes[i];
+            bool match = scheme.error == nullptr;
+            for (size_t pos = 1; pos < scheme_positions && match; ++pos)
+            {
+                if (!(scheme.ops >> pos & 1))
+                    continue;
+                if (pos != 1)
+                    node[pos] = child(pos);
+                match = node_tag(node[pos]) == scheme.tags[pos];
+            }
+            for (size_t j = 0; j < scheme.eqs_cnt && match; ++j)
+                match = child(scheme.eqs[j].pos) == child(scheme.eqs[j].same_as);
+            if (match)
+                return static_cast<int>(i + 1);
+        }
+        return 0;
+    }
+
+    auto const* at = &system.tree[1];
+    while (at->kind != decision::LEAF)
+    {
+        size_t next;
+        if (at->kind == decision::TAG)
+        {
+            if (at->pos != 1)
+                node[at->pos] = child(at->pos);
+            next = at->next[node_tag(node[at->pos])];
+        } else
+        {
+            next = at->next[child(at->pos) == child(at->same_as)];
+        }
+        at = &system.tree[next];
+    }
+    return at->scheme;
+}
+
+// Whether two systems have the same schemes in the same order, up to the
+// names of metavariables and the way the schemes were written
+static inline bool same_axioms(axiom_system const& lhs, axiom_system const& rhs)
+{
+    if (lhs.schemes_cnt != rhs.schemes_cnt)
+        return false;
+
+    for (size_t i = 0; i < lhs.schemes_cnt; ++i)
+    {
+        auto const& l = lhs.schemes[i];
+        auto const& r = rhs.schemes[i];
+        if (l.ops != r.ops || l.eqs_cnt != r.eqs_cnt)
+            return false;
+        for (size_t pos = 0; pos < scheme_positions; ++pos)
+            if (l.tags[pos] != r.tags[pos])
+                return false;
+        for (size_t j = 0; j < l.eqs_cnt; ++j)
+            if (l.eqs[j].pos != r.eqs[j].pos || l.eqs[j].same_as != r.eqs[j].same_as)
+                return false;
+    }
+    return true;
+}
+
+#endif // AXIOMS_H
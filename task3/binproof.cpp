@@ -0,0 +1,263 @@
+#include "binproof.h"
+
+#include <cassert>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+
+using namespace std;
+
+static char const magic[] = {'P', 'R', 'F', 1};
+
+enum
+{
+    var_tag = 4 // node tags below it are operation_type values
+};
+
+static inline void put_u32(string& out, uint32_t x)
+{
+    for (size_t i = 0; i < 4; ++i)
+        out.push_back(static_cast<char>(x >> (8 * i)));
+}
+
+// Bounds-checked cursor; any overrun clears ok and yields zeros
+struct bin_reader
+{
+    char const* cur;
+    char const* end;
+    bool        ok = true;
+
+    size_t left() const { return static_cast<size_t>(end - cur); }
+
+    uint8_t u8()
+    {
+        if (cur == end)
+        {
+            ok = false;
+            return 0;
+        }
+        return static_cast<uint8_t>(*cur++);
+    }
+
+    uint32_t u32()
+    {
+        if (left() < 4)
+        {
+            ok = false;
+            cur = end;
+            return 0;
+        }
+
+        uint32_t x = 0;
+        for (size_t i = 0; i < 4; ++i)
+            x |= static_cast<uint32_t>(static_cast<uint8_t>(*cur++)) << (8 * i);
+        return x;
+    }
+};
+
+// Numbers subformulas in postorder as they are first seen. Uses an explicit
+// stack, so formula depth is not limited by the native one.
+struct bin_writer
+{
+    string                                  vars;
+    string                                  nodes;
+    uint32_t                                vars_cnt = 0;
+    uint32_t                                nodes_cnt = 0;
+    unordered_map<ast_expr_ptr, uint32_t>   ids;
+    unordered_map<string_view, uint32_t>    var_ids;
+
+    uint32_t id(ast_expr_ptr root);
+};
+
+uint32_t bin_writer::id(ast_expr_ptr root)
+{
+    vector<ast_expr_ptr> stack{root};
+    while (!stack.empty())
+    {
+        ast_expr_ptr expr = stack.back();
+        if (ids.count(expr))
+        {
+            stack.pop_back();
+            continue;
+        }
+
+        if (expr->content.index() == 1)
+        {
+            auto name = get<ast_expression::variable>(expr->content).name;
+            auto ins = var_ids.emplace(name, vars_cnt);
+            if (ins.second)
+            {
+                ++vars_cnt;
+                put_u32(vars, static_cast<uint32_t>(name.size()));
+                vars.append(name.begin(), name.end());
+            }
+            nodes.push_back(static_cast<char>(var_tag));
+            put_u32(nodes, ins.first->second);
+        } else
+        {
+            auto& op = get<ast_expression::operation>(expr->content);
+            bool ready = true;
+            for (auto child : op.argv)
+            {
+                if (!ids.count(child))
+                {
+                    stack.push_back(child);
+                    ready = false;
+                }
+            }
+            if (!ready)
+                continue;
+
+            nodes.push_back(static_cast<char>(op.op_type));
+            for (auto child : op.argv)
+                put_u32(nodes, ids[child]);
+        }
+
+        stack.pop_back();
+        ids.emplace(expr, nodes_cnt++);
+    }
+    return ids[root];
+}
+
+bool is_bin_proof(char const* begin, char const* end)
+{
+    return static_cast<size_t>(end - begin) >= sizeof(magic)
+        && memcmp(begin, magic, sizeof(magic)) == 0;
+}
+
+void write_bin_proof(ostream& o, bin_proof const& proof)
+{
+    assert(proof.goal != nullptr);
+    assert(proof.justifications.empty()
+        || proof.justifications.size() == proof.lines.size());
+
+    bin_writer wr;
+    string tail;
+    put_u32(tail, static_cast<uint32_t>(proof.hypotheses.size()));
+    for (auto hyp : proof.hypotheses)
+        put_u32(tail, wr.id(hyp));
+    put_u32(tail, wr.id(proof.goal));
+
+    bool const justified = !proof.justifications.empty();
+    tail.push_back(justified);
+    put_u32(tail, static_cast<uint32_t>(proof.lines.size()));
+    for (size_t i = 0; i < proof.lines.size(); ++i)
+    {
+        put_u32(tail, wr.id(proof.lines[i]));
+        if (!justified)
+            continue;
+
+        auto& just = proof.justifications[i];
+        tail.push_back(static_cast<char>(just.kind));
+        put_u32(tail, just.a);
+        put_u32(tail, just.b);
+    }
+
+    string head(magic, sizeof(magic));
+    put_u32(head, wr.vars_cnt);
+    head += wr.vars;
+    put_u32(head, wr.nodes_cnt);
+
+    o.write(head.data(), head.size());
+    o.write(wr.nodes.data(), wr.nodes.size());
+    o.write(tail.data(), tail.size());
+}
+
+bool read_bin_proof(char const* begin, char const* end,
+                    ast_pool& pool, bin_proof& proof)
+{
+    if (!is_bin_proof(begin, end))
+        return false;
+    bin_reader rd{begin + sizeof(magic), end};
+
+    // counts are checked against what is left, so a bad one can't allocate much
+    uint32_t cnt = rd.u32();
+    if (cnt > rd.left() / 4)
+        return false;
+    vector<var_id> vars;
+    vars.reserve(cnt);
+    for (uint32_t i = 0; i < cnt && rd.ok; ++i)
+    {
+        uint32_t len = rd.u32();
+        if (len == 0 || len > rd.left())
+            return false;
+        vars.push_back(pool.var(string_view(rd.cur, len)));
+        rd.cur += len;
+    }
+
+    cnt = rd.u32();
+    if (cnt > rd.left() / 5)
+        return false;
+    vector<ast_expr_ptr> nodes;
+    nodes.reserve(cnt);
+    auto node = [&rd, &nodes] () -> ast_expr_ptr
+    {
+        uint32_t id = rd.u32();
+        if (id >= nodes.size())
+        {
+            rd.ok = false;
+            return nullptr;
+        }
+        return nodes[id];
+    };
+
+    for (uint32_t i = 0; i < cnt && rd.ok; ++i)
+    {
+        uint8_t tag = rd.u8();
+        if (tag == var_tag)
+        {
+            uint32_t var = rd.u32();
+            if (var >= vars.size())
+                return false;
+            nodes.push_back(pool.intern(vars[var]));
+        } else if (tag == static_cast<uint8_t>(operation_type::NEG))
+        {
+            auto child = node();
+            if (!rd.ok)
+                return false;
+            nodes.push_back(pool.intern(operation_type::NEG, {child}));
+        } else if (tag < var_tag)
+        {
+            auto lhs = node();
+            auto rhs = node();
+            if (!rd.ok)
+                return false;
+            nodes.push_back(pool.intern(static_cast<operation_type>(tag), {lhs, rhs}));
+        } else
+        {
+            return false;
+        }
+    }
+
+    cnt = rd.u32();
+    if (cnt > rd.left() / 4)
+        return false;
+    proof.hypotheses.clear();
+    for (uint32_t i = 0; i < cnt && rd.ok; ++i)
+        proof.hypotheses.push_back(node());
+    proof.goal = node();
+
+    bool const justified = rd.u8() != 0;
+    cnt = rd.u32();
+    if (cnt > rd.left() / 4)
+        return false;
+    proof.lines.clear();
+    proof.justifications.clear();
+    for (uint32_t i = 0; i < cnt && rd.ok; ++i)
+    {
+        proof.lines.push_back(node());
+        if (!justified)
+            continue;
+
+        bin_proof::justification just;
+        uint8_t kind = rd.u8();
+        if (kind > static_cast<uint8_t>(bin_proof::just_kind::MODUS_PONENS))
+            return false;
+        just.kind = static_cast<bin_proof::just_kind>(kind);
+        just.a = rd.u32();
+        just.b = rd.u32();
+        proof.justifications.push_back(just);
+    }
+
+    return rd.ok && rd.cur == rd.end;
+}
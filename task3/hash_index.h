@@ -0,0 +1,173 @@
+#ifndef HASH_INDEX_H
+#define HASH_INDEX_H
+
+#include "parsex.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Open-addressing map from formula hashes, for the checkers' indices of
+// proven lines. Slots are kept in groups of 16 with one control byte each:
+// empty, or 7 bits of the key's hash. A lookup compares a whole group of
+// control bytes at once (one SSE2 compare) and only touches the slots that
+// matched, so a miss usually costs a single cache line and a hit two.
+// Groups are probed quadratically. Nothing is ever erased, so there are no
+// tombstones; pointers into the table are invalidated by inserts.
+template<typename Value>
+class hash_index
+{
+public:
+    using value_type = std::pair<hash_t, Value>;
+    using iterator = value_type*;
+    using const_iterator = value_type const*;
+
+    iterator        end()             { return nullptr; }
+    const_iterator  end() const       { return nullptr; }
+    size_t          size() const      { return used; }
+    bool            empty() const     { return used == 0; }
+
+    iterator find(hash_t const& key)
+    {
+        return const_cast<iterator>(std::as_const(*this).find(key));
+    }
+
+    const_iterator find(hash_t const& key) const
+    {
+        if (used == 0)
+            return nullptr;
+
+        size_t const h = spread(key);
+        for (size_t g = h & group_mask, step = 0; ; g = (g + ++step) & group_mask)
+        {
+            auto masks = match(g, tag(h));
+            for (uint32_t m = masks.first; m != 0; m &= m - 1)
+            {
+                auto& slot = slots[g * group + __builtin_ctz(m)];
+                if (slot.first == key)
+                    return &slot;
+            }
+            if (masks.second != 0)
+                return nullptr;
+        }
+    }
+
+    size_t count(hash_t const& key) const { return find(key) != nullptr; }
+
+    // Never replaces the value of a key that is already there
+    std::pair<iterator, bool> insert(value_type value)
+    {
+        auto found = find(value.first);
+        if (found != nullptr)
+            return {found, false};
+
+        if ((used + 1) * 8 > capacity() * 7)
+            rehash(capacity() == 0 ? group : capacity() * 2);
+        return {put(std::move(value)), true};
+    }
+
+    Value& operator[](hash_t const& key)
+    {
+        return insert({key, Value()}).first->second;
+    }
+
+    // Calls f(entry) for every entry, in no particular order
+    template<typename F>
+    void for_each(F const& f) const
+    {
+        for (size_t i = 0; i < capacity(); ++i)
+            if (ctrl[i] != empty_ctrl)
+                f(slots[i]);
+    }
+
+    void reserve(size_t n)
+    {
+        size_t cap = group;
+        while (cap * 7 < n * 8)
+            cap *= 2;
+        if (cap > capacity())
+            rehash(cap);
+    }
+
+private:
+    enum : size_t
+    {
+        group = 16
+    };
+
+    static constexpr int8_t empty_ctrl = -128;
+
+    std::vector<int8_t>     ctrl;
+    std::vector<value_type> slots;
+    size_t                  group_mask = 0;
+    size_t                  used = 0;
+
+    size_t capacity() const { return ctrl.size(); }
+
+    // The lanes are polynomial hashes, whose low bits depend on the low bits
+    // of the input only; a multiply and a fold spread them over the word.
+    static size_t spread(hash_t const& key)
+    {
+        size_t x = key[0] * 0x9E3779B97F4A7C15ull;
+        return x ^ (x >> 29);
+    }
+
+    static int8_t tag(size_t h) { return static_cast<int8_t>(h >> 57); }
+
+    // Bit i of first: slot i's tag equals t; of second: slot i is empty
+    std::pair<uint32_t, uint32_t> match(size_t g, int8_t t) const
+    {
+        int8_t const* c = ctrl.data() + g * group;
+#if defined(__SSE2__)
+        __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(c));
+        return {static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(t)))),
+                static_cast<uint32_t>(_mm_movemask_epi8(v))};
+#else
+        std::pair<uint32_t, uint32_t> result{0, 0};
+        for (size_t i = 0; i < group; ++i)
+        {
+            result.first |= uint32_t(c[i] == t) << i;
+            result.second |= uint32_t(c[i] == empty_ctrl) << i;
+        }
+        return result;
+#endif
+    }
+
+    // Places a key known to be absent, the table having room for it
+    iterator put(value_type&& value)
+    {
+        size_t const h = spread(value.first);
+        for (size_t g = h & group_mask, step = 0; ; g = (g + ++step) & group_mask)
+        {
+            uint32_t free = match(g, empty_ctrl).second;
+            if (free == 0)
+                continue;
+
+            size_t i = g * group + __builtin_ctz(free);
+            ctrl[i] = tag(h);
+            slots[i] = std::move(value);
+            ++used;
+            return &slots[i];
+        }
+    }
+
+    void rehash(size_t cap)
+    {
+        std::vector<int8_t> old_ctrl(cap, empty_ctrl);
+        std::vector<value_type> old_slots(cap);
+        old_ctrl.swap(ctrl);
+        old_slots.swap(slots);
+        group_mask = cap / group - 1;
+        used = 0;
+
+        for (size_t i = 0; i < old_ctrl.size(); ++i)
+            if (old_ctrl[i] != empty_ctrl)
+                put(std::move(old_slots[i]));
+    }
+};
+
+#endif // HASH_INDEX_H
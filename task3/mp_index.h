@@ -0,0 +1,86 @@
+#ifndef MP_INDEX_H
+#define MP_INDEX_H
+
+#include "hash_index.h"
+
+#include <cstdint>
+#include <vector>
+
+// Sum of two costs, saturating: a cost counts the lines of a proof tree,
+// and on proofs that reuse lines that grows exponentially
+static inline size_t mp_cost(size_t lhs, size_t rhs)
+{
+    return rhs > SIZE_MAX - lhs ? SIZE_MAX : lhs + rhs;
+}
+
+// Modus ponens justifications, kept ready by the hash of the formula they
+// prove. Every proven implication A->B is either paired with the proof of
+// A right away or parked under A's hash until A is proven; either way the
+// pair is offered to B once and B keeps the cheapest one. A line then
+// finds its justification with one lookup, instead of trying every proven
+// implication that ends in it.
+//
+// Line is how the caller names a proof line, a pointer or an index. The
+// cost given with a line must not change once it's indexed.
+template<typename Line>
+class mp_index
+{
+public:
+    struct justification
+    {
+        Line    impl;       // A->B
+        Line    premise;    // A
+        size_t  cost;
+    };
+
+    // The cheapest justification of a formula, or nullptr
+    justification const* find(hash_t const& consequent) const
+    {
+        auto it = ready.find(consequent);
+        return it == ready.end() ? nullptr : &it->second;
+    }
+
+    // line is the first proof of a formula with hash h
+    void proven(hash_t const& h, Line line, size_t cost)
+    {
+        auto it = pending.find(h);
+        if (it == pending.end())
+            return;
+
+        for (auto& p : it->second)
+            offer(p.consequent, p.impl, line, mp_cost(p.cost, cost));
+        std::vector<parked>().swap(it->second);
+    }
+
+    // impl is the first proof of an implication whose antecedent isn't
+    // proven yet
+    void implication(Line impl,
+                     size_t cost,
+                     hash_t const& antecedent,
+                     hash_t const& consequent)
+    {
+        pending[antecedent].push_back({consequent, impl, cost});
+    }
+
+    // consequent follows from impl and premise, cost being mp_cost() of theirs;
+    // on a tie the pair offered first stays
+    void offer(hash_t const& consequent, Line impl, Line premise, size_t cost)
+    {
+        auto ins = ready.insert({consequent, {impl, premise, cost}});
+        if (!ins.second && ins.first->second.cost > cost)
+            ins.first->second = {impl, premise, cost};
+    }
+
+private:
+    struct parked
+    {
+        hash_t  consequent;
+        Line    impl;
+        size_t  cost;
+    };
+
+    hash_index<justification>       ready;
+    hash_index<std::vector<parked>> pending;
+};
+
+#endif // MP_INDEX_H
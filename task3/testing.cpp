@@ -1,5 +1,10 @@
 #include "parsex.h"
 #include "templates.h"
+#include "binproof.h"
+#include "axioms.h"
+#include "hash_index.h"
+#include "mp_index.h"
+#include "line_table.h"
 
 #include <iostream>
 #include <unordered_map>
@@ -7,346 +12,201 @@
 #include <cassert>
 #include <unistd.h>
 #include <sstream>
+#include <thread>
 
 using namespace std;
 
-struct ast_record
-{
-    using mp_dependencies_t = pair<ast_record*, ast_record*>;
-
-    variant<ast_expr_ptr, string>   ast;        // main memory optimization
-    optional<string>                annotation;
-    optional<mp_dependencies_t>     modus_ponens_deps;
-    bool                            was_used_to_prove = 0;
-    size_t                          id = 0;
-    size_t                          mp_subtree_size = 1;
-    hash_t                          hashcode;
-    optional<hash_t>                l_hash;
-
-    ast_record(ast_expr_ptr ptr)
-        : ast(move(ptr)),
-          hashcode(get<ast_expr_ptr>(ast)->hashcode)
-    {}
-};
-
-static inline bool is_op(ast_expression* ptr)
+static inline bool is_op(ast_expr_ptr ptr)
 {
     return ptr->content.index() == 0;
 }
 
-static inline auto& get_op(ast_expression* ptr)
+static inline auto& get_op(ast_expr_ptr ptr)
 {
     return get<ast_expression::operation>(ptr->content);
 }
 
-static inline bool is_op(ast_expression* ptr,
+static inline bool is_op(ast_expr_ptr ptr,
                          operation_type type)
 {
     return is_op(ptr)
         && get_op(ptr).op_type == type;
 }
 
-static inline ast_expression* subtree(ast_expression* ptr,
-                                      size_t ind)
+static inline ast_expr_ptr subtree(ast_expr_ptr ptr,
+                                   size_t ind)
 {
     assert(ind >= 0 && ind <= 1);
-    return get_op(ptr).argv[ind].get();
+    return get_op(ptr).argv[ind];
 }
 
-bool check_if_axiom(ast_record* ast_rec,
-                    size_t& line)
+// Number of the classical scheme ast is an instance of, 0 if none
+static inline int classc_axiom_scheme(ast_expr_ptr ast)
 {
-    ast_expression* const ast = get<ast_expr_ptr>(ast_rec->ast).get();
-    static stringstream ss;
-    ss.str("");
-    ss << *ast;
-
-    // 1. A->(B->A)
-    if (is_op(subtree(ast, 1))
-        && get_op(subtree(ast, 1)).op_type == operation_type::IMPL
-        && subtree(subtree(ast, 1), 1)->hashcode == subtree(ast, 0)->hashcode)
-    {
-        ast_rec->annotation = "Ax. sch. 1";
-        neg_hypotesis(cout, line, ss.str());
-        return true;
-    }
-    // 2. (A->B) -> (A->B->C) -> (A->C)
-    if (is_op(subtree(ast, 0), operation_type::IMPL)
-        && is_op(subtree(ast, 1), operation_type::IMPL)
-        && is_op(subtree(subtree(ast, 1), 0), operation_type::IMPL)
-        && is_op(subtree(subtree(ast, 1), 1), operation_type::IMPL)
-        && is_op(subtree(subtree(subtree(ast, 1), 0), 1), operation_type::IMPL)
-        && subtree(subtree(ast, 0), 0)->hashcode == subtree(subtree(subtree(ast, 1), 0), 0)->hashcode // | matching A
-        && subtree(subtree(ast, 0), 0)->hashcode == subtree(subtree(subtree(ast, 1), 1), 0)->hashcode // |
-        && subtree(subtree(ast, 0), 1)->hashcode == subtree(subtree(subtree(subtree(ast, 1), 0), 1), 0)->hashcode
-        && subtree(subtree(subtree(subtree(ast, 1), 0), 1), 1)->hashcode == subtree(subtree(subtree(ast, 1), 1), 1)->hashcode)
-    {
-        ast_rec->annotation = "Ax. sch. 2";
-        neg_hypotesis(cout, line, ss.str());
-        return true;
-    }
-    // 3. A->B->A&B
-    if (is_op(subtree(ast, 1), operation_type::IMPL)
-        && is_op(subtree(subtree(ast, 1), 1), operation_type::CONJ)
-        && subtree(ast, 0)->hashcode == subtree(subtree(subtree(ast, 1), 1), 0)->hashcode
-        && subtree(subtree(ast, 1), 0)->hashcode == subtree(subtree(subtree(ast, 1), 1), 1)->hashcode)
-    {
-        ast_rec->annotation = "Ax. sch. 3";
-        neg_hypotesis(cout, line, ss.str());
-        return true;
-    }
-
-    // 4. A&B->A
-    if (is_op(subtree(ast, 0), operation_type::CONJ)
-        && subtree(subtree(ast, 0), 0)->hashcode == subtree(ast, 1)->hashcode)
-    {
-        ast_rec->annotation = "Ax. sch. 4";
-        neg_hypotesis(cout, line, ss.str());
-        return true;
-    }
-
-    // 5. A&B->B
-    if (is_op(subtree(ast, 0), operation_type::CONJ)
-        && subtree(subtree(ast, 0), 1)->hashcode == subtree(ast, 1)->hashcode)
-    {
-        ast_rec->annotation = "Ax. sch. 5";
-        neg_hypotesis(cout, line, ss.str());
-        return true;
-    }
-
-    // 6. A->A|B
-    if (is_op(subtree(ast, 1), operation_type::DISJ)
-        && subtree(ast, 0)->hashcode == subtree(subtree(ast, 1), 0)->hashcode)
-    {
-        ast_rec->annotation = "Ax. sch. 6";
-        neg_hypotesis(cout, line, ss.str());
-        return true;
-    }
-
-    // 7. B->A|B
-    if (is_op(subtree(ast, 1), operation_type::DISJ)
-        && subtree(ast, 0)->hashcode == subtree(subtree(ast, 1), 1)->hashcode)
-    {
-        ast_rec->annotation = "Ax. sch. 7";
-        neg_hypotesis(cout, line, ss.str());
-        return true;
-    }
-
-    // 8. (A->C) -> (B->C) -> (A|B->C)
-    if (is_op(subtree(ast, 0), operation_type::IMPL)
-        && is_op(subtree(ast, 1), operation_type::IMPL)
-        && is_op(subtree(subtree(ast, 1), 0), operation_type::IMPL)
-        && is_op(subtree(subtree(ast, 1), 1), operation_type::IMPL)
-        && is_op(subtree(subtree(subtree(ast, 1), 1), 0), operation_type::DISJ)
-        && subtree(subtree(ast, 0), 0)->hashcode == subtree(subtree(subtree(subtree(ast, 1), 1), 0), 0)->hashcode // match A
-        && subtree(subtree(subtree(ast, 1), 0), 0)->hashcode == subtree(subtree(subtree(subtree(ast, 1), 1), 0), 1)->hashcode //match B
-        && subtree(subtree(ast, 0), 1)->hashcode == subtree(subtree(subtree(ast, 1), 0), 1)->hashcode   // C
-        && subtree(subtree(ast, 0), 1)->hashcode == subtree(subtree(subtree(ast, 1), 1), 1)->hashcode)  // C
-    {
-        ast_rec->annotation = "Ax. sch. 8";
-        neg_hypotesis(cout, line, ss.str());
-        return true;
-    }
-
-    // 9. (A->B) -> (A->!B) -> !B
-    if (is_op(subtree(ast, 0), operation_type::IMPL)
-        && is_op(subtree(ast, 1), operation_type::IMPL)
-        && is_op(subtree(subtree(ast, 1), 0), operation_type::IMPL)
-        && is_op(subtree(subtree(ast, 1), 1), operation_type::NEG)
-        && is_op(subtree(subtree(subtree(ast, 1), 0), 1), operation_type::NEG)
-        && subtree(subtree(ast, 0), 0)->hashcode == subtree(subtree(subtree(ast, 1), 0), 0)->hashcode
-        && subtree(subtree(ast, 0), 0)->hashcode == subtree(subtree(subtree(ast, 1), 1), 0)->hashcode
-        && subtree(subtree(ast, 0), 1)->hashcode == subtree(subtree(subtree(subtree(ast, 1), 0), 1), 0)->hashcode)
-    {
-        ast_rec->annotation = "Ax. sch. 9";
-        neg_hypotesis(cout, line, ss.str());
-        return true;
-    }
-
-    return false;
+    return match_axiom<classical_axioms>(ast);
 }
 
-bool check_if_classc_axiom(ast_record* ast_rec,
-                           size_t& line)
+// What a line is by itself, whatever its place in the proof
+struct line_class
 {
-    ast_expression* const ast = get<ast_expr_ptr>(ast_rec->ast).get();
-
-    if (!is_op(ast)) return false;
-
-    auto& op = get_op(ast);
-    if (op.op_type != operation_type::IMPL) return false;
-
-    if (check_if_axiom(ast_rec, line)) return true;
-
-    // 10. !!A->A
-    if (is_op(subtree(ast, 0), operation_type::NEG)
-        && is_op(subtree(subtree(ast, 0), 0), operation_type::NEG)
-        && subtree(subtree(subtree(ast, 0), 0), 0)->hashcode == subtree(ast, 1)->hashcode)
-    {
-        ast_rec->annotation = "Ax. sch. 10";
-        tenth_axiom(cout, line, to_string(*subtree(ast, 1)));
-        return true;
-    }
-
-    return false;
-}
+    size_t  hypothesis = 0; // 1-based, 0 if none
+    int     scheme = 0;     // see classc_axiom_scheme()
+};
 
+// Classifies every line, a slice of them per core. Only modus ponens
+// depends on the lines before, so that is all the sequential pass is left
+// with. The indices are only read here.
 template<typename Container>
-bool check_if_hypotesis(ast_record* ast_rec,
-                        Container const& mp,
-                        size_t& line)
+vector<line_class> classify_lines(vector<ast_expr_ptr> const& lines,
+                                  Container const& hypotheses)
 {
-    auto f = mp.find(get<ast_expr_ptr>(ast_rec->ast)->hashcode);
-    if (f != mp.end())
+    enum
     {
-        ast_rec->annotation = "Hypothesis " + to_string(f->second);
+        min_slice = 1u << 14
+    };
 
-        neg_hypotesis(std::cout, line, to_string(*get<ast_expr_ptr>(ast_rec->ast)));
-    }
-    return f != mp.end();
-}
-
-void mark_dependencies(ast_record* ast_rec)
-{
-    ast_rec->was_used_to_prove = true;
-    if (ast_rec->modus_ponens_deps)
+    vector<line_class> result(lines.size());
+    auto classify = [&] (size_t begin, size_t end)
     {
-        mark_dependencies(ast_rec->modus_ponens_deps->first);
-        mark_dependencies(ast_rec->modus_ponens_deps->second);
-    }
+        for (size_t i = begin; i < end; ++i)
+        {
+            auto f = hypotheses.find(lines[i]->hashcode);
+            if (f != hypotheses.end())
+                result[i].hypothesis = f->second;
+            else
+                result[i].scheme = classc_axiom_scheme(lines[i]);
+        }
+    };
+
+    size_t slices = min<size_t>(max(thread::hardware_concurrency(), 1u),
+                                lines.size() / min_slice + 1);
+    vector<thread> workers;
+    for (size_t i = 1; i < slices; ++i)
+        workers.emplace_back(classify, lines.size() / slices * i,
+                             i + 1 == slices ? lines.size() : lines.size() / slices * (i + 1));
+    classify(0, lines.size() / slices);
+    for (auto& worker : workers)
+        worker.join();
+    return result;
 }
 
-using all_ast_trees_t = vector<unique_ptr<ast_record>>;
-using hash_to_record_t = unordered_map<hash_t, ast_record*, hash_t_hash>;
-using ast_set_by_hash_t = unordered_map<hash_t, unordered_map<hash_t, ast_record*, hash_t_hash>, hash_t_hash>;
-using id_by_hash_t = unordered_map<hash_t, size_t, hash_t_hash>;
+using hash_to_line_t = hash_index<uint32_t>;
+using id_by_hash_t = hash_index<size_t>;
 
 int main()
 {
 //    sleep(8);
     reader_impl             rdr;
-    all_ast_trees_t         all_asts;
-    vector<ast_record*>     expressions_order;
+    ast_pool                pool;
     id_by_hash_t            hypotheses;
-    vector<ast_expression*> hypotheses_order; // TODO: ast_expr* -> ast_record*
-    hash_to_record_t        proven_by_hash;
-    ast_set_by_hash_t       proven_impl_by_right_subtree_hash;
-    ast_expr_ptr            result;
+    hash_to_line_t          proven_by_hash;
+    mp_index<uint32_t>      modus_ponens;
+    bin_proof               proof;
 
-    assert(!eof(rdr));
-    size_t id = 1;
-    if (!goes_next(rdr, "|-"))
+    parser prs(rdr, pool);
+    if (fill(rdr, 4) && is_bin_proof(rdr.read_left, rdr.read_right))
     {
-        while (true)
+        string data = read_rest(rdr);
+        if (!read_bin_proof(data.data(), data.data() + data.size(), pool, proof))
         {
-            auto expr = parse_expr(rdr);
-            auto* ptr = expr.get();
-            hypotheses_order.push_back(ptr);
-            auto ins = hypotheses.insert({ptr->hashcode, id++});
-            assert(ins.second);
-            all_asts.push_back(make_unique<ast_record>(move(expr)));
+            cout << "Malformed binary proof" << endl;
+            return 0;
+        }
+    } else
+    {
+        assert(!eof(rdr));
+        if (!goes_next(rdr, "|-"))
+        {
+            while (true)
+            {
+                proof.hypotheses.push_back(parse_expr(prs));
 
-            if (*rdr.read_left != ',')
-                break;
-            else
-                ++rdr.read_left;
+                if (*rdr.read_left != ',')
+                    break;
+                else
+                    ++rdr.read_left;
+            }
         }
-    }
 
-    assert(goes_next(rdr, "|-"));
-    rdr.read_left += 2;
-    result = parse_expr(rdr);
+        assert(goes_next(rdr, "|-"));
+        rdr.read_left += 2;
+        proof.goal = parse_expr(prs);
+
+        while (!eof(rdr))
+            proof.lines.push_back(parse_expr(prs));
+    }
 
-    for (size_t i = 0; i < hypotheses_order.size(); ++i)
+    for (size_t i = 0; i < proof.hypotheses.size(); ++i)
     {
+        auto ins = hypotheses.insert({proof.hypotheses[i]->hashcode, i + 1});
+        assert(ins.second);
         if (i != 0)
             cout << ", ";
-        cout << *hypotheses_order[i];
+        cout << *proof.hypotheses[i];
     }
     cout << "|-!!";
-    cout << *result << endl;
+    cout << *proof.goal << endl;
+
+    auto const classes = classify_lines(proof.lines, hypotheses);
+    line_table lines(move(proof.lines));
 
-    id = 0;
     size_t line = 0;
-    while (!eof(rdr))
+    for (uint32_t i = 0; i < lines.size(); ++i)
     {
         line++;
-        auto expr = parse_expr(rdr);
-        auto* ptr = expr.get();
-        auto ast_record_ptr = make_unique<ast_record>(move(expr));
-
-        ast_record* ast_rec = ast_record_ptr.get();
-        all_asts.push_back(move(ast_record_ptr));
-
-        expressions_order.push_back(ast_rec);
-
-        if (!check_if_hypotesis(ast_rec, hypotheses, line)
-         && !check_if_classc_axiom(ast_rec, line))
+        ast_expr_ptr const ptr = lines.formula[i];
+        auto const& cls = classes[i];
+        if (cls.hypothesis != 0)
         {
-            bool modus_ponens_found = false;
-            auto it = proven_impl_by_right_subtree_hash.find(ast_rec->hashcode);
-            if (it != proven_impl_by_right_subtree_hash.end())
-            {
-                for (auto hash_and_parent : it->second)
-                {
-                    auto it2 = proven_by_hash.find(*hash_and_parent.second->l_hash);
-                    if (it2 == proven_by_hash.end()) continue;
-
-                    if (!modus_ponens_found)
-                    {
-                        ast_rec->modus_ponens_deps = make_pair(hash_and_parent.second, it2->second);
-                        ast_rec->mp_subtree_size = hash_and_parent.second->mp_subtree_size
-                                                 + it2->second->mp_subtree_size
-                                                 + 1;
-                        modus_ponens_found = true;
-                    } else
-                    {
-                        if (ast_rec->modus_ponens_deps->first->mp_subtree_size + ast_rec->modus_ponens_deps->second->mp_subtree_size
-                            > hash_and_parent.second->mp_subtree_size + it2->second->mp_subtree_size)
-                        {
-                            ast_rec->modus_ponens_deps = make_pair(hash_and_parent.second, it2->second);
-                            ast_rec->mp_subtree_size = hash_and_parent.second->mp_subtree_size
-                                                     + it2->second->mp_subtree_size
-                                                     + 1;
-                        }
-                    }
-                }
-            }
-
-            if (!modus_ponens_found)
+            lines.kinds[i] = line_table::kind::HYPOTHESIS;
+            lines.number[i] = cls.hypothesis;
+            neg_hypotesis(cout, line, to_string(*ptr));
+        } else if (cls.scheme == 10)
+        {
+            lines.kinds[i] = line_table::kind::AXIOM;
+            lines.number[i] = cls.scheme;
+            tenth_axiom(cout, line, to_string(*subtree(ptr, 1)));
+        } else if (cls.scheme != 0)
+        {
+            lines.kinds[i] = line_table::kind::AXIOM;
+            lines.number[i] = cls.scheme;
+            neg_hypotesis(cout, line, to_string(*ptr));
+        } else
+        {
+            auto mp = modus_ponens.find(ptr->hashcode);
+            if (mp == nullptr)
             {
                 cout << "Proof is incorrect" << endl;
                 cerr << *ptr << endl;
                 return -1;
             }
 
-            auto pr = *ast_rec->modus_ponens_deps;
-            auto A = to_string(*get<ast_expr_ptr>(pr.second->ast));
-            auto B = to_string(*get<ast_expression::operation>(get<ast_expr_ptr>(pr.first->ast)->content).argv[1]);
+            lines.kinds[i] = line_table::kind::MODUS_PONENS;
+            lines.impl[i] = mp->impl;
+            lines.premise[i] = mp->premise;
+            lines.mp_subtree_size[i] = mp_cost(mp->cost, 1);
+
+            auto A = to_string(*lines.formula[mp->premise]);
+            auto B = to_string(*subtree(lines.formula[mp->impl], 1));
 
 //            std::cerr << "#MP" << A << " and " << B << endl;
             neg_modus_ponens(cout, line, A, B);
         }
 
-        bool inserted = false;
-        auto it = proven_by_hash.find(ptr->hashcode);
-        if (it == proven_by_hash.end()
-         || it->second->mp_subtree_size > ast_rec->mp_subtree_size)
+        if (proven_by_hash.insert({ptr->hashcode, i}).second)
         {
-            inserted = true;
-            proven_by_hash.insert(it, {ptr->hashcode, ast_rec});
-        }
-
-        if (is_op(ptr, operation_type::IMPL))
-        {
-            inserted = true;
-            proven_impl_by_right_subtree_hash[subtree(ptr, 1)->hashcode].insert({ptr->hashcode, ast_rec});
-            ast_rec->l_hash = subtree(ptr, 0)->hashcode;
-        }
-
-        if (!inserted)
-        {
-            expressions_order.pop_back();
+            modus_ponens.proven(ptr->hashcode, i, lines.mp_subtree_size[i]);
+            if (is_op(ptr, operation_type::IMPL))
+            {
+                auto antecedent = subtree(ptr, 0)->hashcode;
+                auto consequent = subtree(ptr, 1)->hashcode;
+                auto premise = proven_by_hash.find(antecedent);
+                if (premise != proven_by_hash.end())
+                    modus_ponens.offer(consequent, i, premise->second,
+                                       mp_cost(lines.mp_subtree_size[i], lines.mp_subtree_size[premise->second]));
+                else
+                    modus_ponens.implication(i, lines.mp_subtree_size[i], antecedent, consequent);
+            }
         }
     }
 
@@ -1,88 +1,96 @@
 #include "ast_record.h"
+#include "axioms.h"
 
-#include <unordered_set>
 #include <algorithm>
 
 template<class... Ts> struct overloaded : Ts... { using Ts::operator()...; };
 template<class... Ts> overloaded(Ts...) -> overloaded<Ts...>;
 
 static inline void
-get_varnames_impl(ast_expression* ptr,
-                  std::unordered_set<std::string>& hs)
+get_varnames_impl(ast_expression const* ptr,
+                  varnames_t& vars)
 {
     std::visit(overloaded
     {
-       [&hs] (ast_expression::operation const& op)
+       [&vars] (ast_expression::operation const& op)
           {
                for (auto&& c : op.argv)
-                   get_varnames_impl(c.get(), hs);
+                   get_varnames_impl(c, vars);
           },
-       [&hs] (std::string const& varname)
+       [&vars] (ast_expression::variable const& var)
           {
-               hs.insert(varname);
+               // at most 16 of them, see the uint16_t masks
+               if (std::find(vars.begin(), vars.end(), var.id) == vars.end())
+                   vars.push_back(var.id);
           },
 
     }, ptr->content);
 }
 
-static inline std::vector<std::string>
-get_varnames(ast_expression* ptr)
+static inline varnames_t
+get_varnames(ast_expression const* ptr)
 {
-    std::unordered_set<std::string> hs;
-    get_varnames_impl(ptr, hs);
-    return {hs.begin(), hs.end()};
+    varnames_t vars;
+    get_varnames_impl(ptr, vars);
+    return vars;
 }
 
-ast_record::ast_record(ast_expr_ptr ptr)
-    : ast(move(ptr)),
-      hashcode(std::get<0>(ast)->hashcode),
-      varnames(get_varnames(std::get<0>(ast).get()))
+ast_pool& formula_pool()
 {
-    if (is_op(std::get<0>(ast).get(), operation_type::IMPL))
-        l_hash = subtree(std::get<0>(ast).get(), 0)->hashcode;
+    static ast_pool pool;
+    return pool;
 }
 
-static inline bool apply(ast_expression const* ast,
-                         std::vector<std::string> const& varnames,
-                         uint16_t mask)
+ast_record::ast_record(ast_expr_ptr ptr)
+    : ast(ptr),
+      hashcode(std::get<0>(ast)->hashcode),
+      varnames(get_varnames(std::get<0>(ast)))
+{}
+
+/**
+ * @brief Evaluates flat formula ast, variable var_ix being (mask >> var_bits[var_ix]) & 1.
+ * @param values Scratch space, one slot per node.
+ */
+static inline bool apply(flat_ast const& ast,
+                         std::vector<uint16_t> const& var_bits,
+                         uint16_t mask,
+                         std::vector<char>& values)
 {
-    
-    return std::visit(overloaded
+    for (size_t i = 0; i < ast.nodes.size(); ++i)
     {
-       [&varnames, mask] (ast_expression::operation const& op)
-          {
-                switch (op.op_type)
-                {
-                case operation_type::NEG:
-                   return !apply(op.argv[0].get(), varnames, mask);
-                case operation_type::CONJ:
-                   return apply(op.argv[0].get(), varnames, mask)
-                           && apply(op.argv[1].get(), varnames, mask);
-                case operation_type::DISJ:
-                   return apply(op.argv[0].get(), varnames, mask)
-                           || apply(op.argv[1].get(), varnames, mask);
-                case operation_type::IMPL:
-                   return !apply(op.argv[0].get(), varnames, mask)
-                           || apply(op.argv[1].get(), varnames, mask);
-                default:
-                   assert(false && "Unknown op type");
-                   exit(-1);
-                }
-          },
-       [&varnames, mask] (std::string const& varname)
-          {
-                auto const p = std::find(varnames.begin(),
-                                         varnames.end(),
-                                         varname)
-                       - varnames.begin();
-                return static_cast<bool>(mask & (1 << p));
-          },
-    }, ast->content);
+        auto const& node = ast.nodes[i];
+        if (node.is_var)
+        {
+            values[i] = (mask >> var_bits[node.var_ix]) & 1;
+            continue;
+        }
+
+        switch (node.op_type)
+        {
+        case operation_type::NEG:
+            values[i] = !values[node.lhs];
+            break;
+        case operation_type::CONJ:
+            values[i] = values[node.lhs] && values[node.rhs];
+            break;
+        case operation_type::DISJ:
+            values[i] = values[node.lhs] || values[node.rhs];
+            break;
+        case operation_type::IMPL:
+            values[i] = !values[node.lhs] || values[node.rhs];
+            break;
+        default:
+            assert(false && "Unknown op type");
+            exit(-1);
+        }
+    }
+
+    return values.back();
 }
 
 static inline std::optional<hypotesis_set>
 try_find_hypset_impl(ast_expression const* ast_rec,
-                     std::vector<std::string> const& varnames,
+                     varnames_t const& varnames,
                      bool const negated)
 {
     hypotesis_set result_st(varnames);
@@ -118,17 +126,29 @@ try_find_hypset_impl(ast_expression const* ast_rec,
 }
 
 std::optional<hypotesis_set> try_find_hypset(ast_expr_ptr& ast_rec,
-                                             std::vector<std::string> const& varnames)
+                                             varnames_t const& varnames)
 {
-    auto res = try_find_hypset_impl(ast_rec.get(), varnames, false);
+    auto res = try_find_hypset_impl(ast_rec, varnames, false);
     if (res)
         return res;
 
-    ast_rec = negated(move(ast_rec));
-    res = try_find_hypset_impl(ast_rec.get(), varnames, true);
+    ast_rec = negated(ast_rec);
+    res = try_find_hypset_impl(ast_rec, varnames, true);
     return res;
 }
 
+// flatten() of a formula, made once: the generator asks is_valid() about
+// the same subformulas under every hypothesis set. Formulas are interned,
+// so the pointer stands for the formula.
+static flat_ast const& flattened(ast_expr_ptr ast)
+{
+    static std::unordered_map<ast_expr_ptr, flat_ast> cache;
+    auto it = cache.find(ast);
+    if (it == cache.end())
+        it = cache.emplace(ast, flatten(ast)).first;
+    return it->second;
+}
+
 bool is_valid(ast_expression const* ast,
               hypotesis_set const& hyp_set) noexcept
 {
@@ -155,9 +175,19 @@ bool is_valid(ast_expression const* ast,
     m <<= 16 - n;
     m >>= 16 - n;
 
+    auto const& flat = flattened(ast);
+    std::vector<uint16_t> var_bits;
+    var_bits.reserve(flat.vars.size());
+    for (auto&& var : flat.vars)
+        var_bits.push_back(std::find(hyp_set.varnames.begin(),
+                                     hyp_set.varnames.end(),
+                                     var)
+                           - hyp_set.varnames.begin());
+    std::vector<char> values(flat.nodes.size());
+
     for (uint16_t s = m; ; s = (s - 1) & m)
     {
-        if (!apply(ast, hyp_set.varnames, s | mask2))
+        if (!apply(flat, var_bits, s | mask2, values))
             return false;
 
         if (s == 0) break;
@@ -184,103 +214,6 @@ hypotesis_set& hypotesis_set::operator=(hypotesis_set&& rhs) noexcept
 
 bool check_if_axiom(ast_expression const* ast)
 {
-    if (ast == nullptr) return false;
-    if (!is_op(ast)) return false;
-
-    auto& op = get_op(ast);
-    if (op.op_type != operation_type::IMPL) return false;
-
-    // 1. A->(B->A)
-    if (is_op(subtree(ast, 1))
-            && get_op(subtree(ast, 1)).op_type == operation_type::IMPL
-            && subtree(subtree(ast, 1), 1)->hashcode == subtree(ast, 0)->hashcode)
-    {
-        return true;
-    }
-    // 2. (A->B) -> (A->B->C) -> (A->C)
-    if (is_op(subtree(ast, 0), operation_type::IMPL)
-            && is_op(subtree(ast, 1), operation_type::IMPL)
-            && is_op(subtree(subtree(ast, 1), 0), operation_type::IMPL)
-            && is_op(subtree(subtree(ast, 1), 1), operation_type::IMPL)
-            && is_op(subtree(subtree(subtree(ast, 1), 0), 1), operation_type::IMPL)
-            && subtree(subtree(ast, 0), 0)->hashcode == subtree(subtree(subtree(ast, 1), 0), 0)->hashcode // | matching A
-            && subtree(subtree(ast, 0), 0)->hashcode == subtree(subtree(subtree(ast, 1), 1), 0)->hashcode // |
-            && subtree(subtree(ast, 0), 1)->hashcode == subtree(subtree(subtree(subtree(ast, 1), 0), 1), 0)->hashcode
-            && subtree(subtree(subtree(subtree(ast, 1), 0), 1), 1)->hashcode == subtree(subtree(subtree(ast, 1), 1), 1)->hashcode)
-    {
-        return true;
-    }
-    // 3. A->B->A&B
-    if (is_op(subtree(ast, 1), operation_type::IMPL)
-            && is_op(subtree(subtree(ast, 1), 1), operation_type::CONJ)
-            && subtree(ast, 0)->hashcode == subtree(subtree(subtree(ast, 1), 1), 0)->hashcode
-            && subtree(subtree(ast, 1), 0)->hashcode == subtree(subtree(subtree(ast, 1), 1), 1)->hashcode)
-    {
-        return true;
-    }
-
-    // 4. A&B->A
-    if (is_op(subtree(ast, 0), operation_type::CONJ)
-            && subtree(subtree(ast, 0), 0)->hashcode == subtree(ast, 1)->hashcode)
-    {
-        return true;
-    }
-
-    // 5. A&B->B
-    if (is_op(subtree(ast, 0), operation_type::CONJ)
-            && subtree(subtree(ast, 0), 1)->hashcode == subtree(ast, 1)->hashcode)
-    {
-        return true;
-    }
-
-    // 6. A->A|B
-    if (is_op(subtree(ast, 1), operation_type::DISJ)
-            && subtree(ast, 0)->hashcode == subtree(subtree(ast, 1), 0)->hashcode)
-    {
-        return true;
-    }
-
-    // 7. B->A|B
-    if (is_op(subtree(ast, 1), operation_type::DISJ)
-            && subtree(ast, 0)->hashcode == subtree(subtree(ast, 1), 1)->hashcode)
-    {
-        return true;
-    }
-
-    // 8. (A->C) -> (B->C) -> (A|B->C)
-    if (is_op(subtree(ast, 0), operation_type::IMPL)
-            && is_op(subtree(ast, 1), operation_type::IMPL)
-            && is_op(subtree(subtree(ast, 1), 0), operation_type::IMPL)
-            && is_op(subtree(subtree(ast, 1), 1), operation_type::IMPL)
-            && is_op(subtree(subtree(subtree(ast, 1), 1), 0), operation_type::DISJ)
-            && subtree(subtree(ast, 0), 0)->hashcode == subtree(subtree(subtree(subtree(ast, 1), 1), 0), 0)->hashcode // match A
-            && subtree(subtree(subtree(ast, 1), 0), 0)->hashcode == subtree(subtree(subtree(subtree(ast, 1), 1), 0), 1)->hashcode //match B
-            && subtree(subtree(ast, 0), 1)->hashcode == subtree(subtree(subtree(ast, 1), 0), 1)->hashcode   // C
-            && subtree(subtree(ast, 0), 1)->hashcode == subtree(subtree(subtree(ast, 1), 1), 1)->hashcode)  // C
-    {
-        return true;
-    }
-
-    // 9. (A->B) -> (A->!B) -> !B
-    if (is_op(subtree(ast, 0), operation_type::IMPL)
-            && is_op(subtree(ast, 1), operation_type::IMPL)
-            && is_op(subtree(subtree(ast, 1), 0), operation_type::IMPL)
-            && is_op(subtree(subtree(ast, 1), 1), operation_type::NEG)
-            && is_op(subtree(subtree(subtree(ast, 1), 0), 1), operation_type::NEG)
-            && subtree(subtree(ast, 0), 0)->hashcode == subtree(subtree(subtree(ast, 1), 0), 0)->hashcode
-            && subtree(subtree(ast, 0), 0)->hashcode == subtree(subtree(subtree(ast, 1), 1), 0)->hashcode
-            && subtree(subtree(ast, 0), 1)->hashcode == subtree(subtree(subtree(subtree(ast, 1), 0), 1), 0)->hashcode)
-    {
-        return true;
-    }
-
-    // 10. !!A->A
-    if (is_op(subtree(ast, 0), operation_type::NEG)
-            && is_op(subtree(subtree(ast, 0), 0), operation_type::NEG)
-            && subtree(subtree(subtree(ast, 0), 0), 0)->hashcode == subtree(ast, 1)->hashcode)
-    {
-        return true;
-    }
-
-    return false;
+    return ast != nullptr
+        && match_axiom<classical_axioms>(ast) != 0;
 }
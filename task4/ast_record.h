@@ -7,6 +7,8 @@
 #include <optional>
 #include <unordered_map>
 
+using varnames_t = std::vector<var_id>;
+
 struct ast_record
 {
     using mp_dependencies_t = std::pair<ast_record*, ast_record*>;
@@ -14,15 +16,12 @@ struct ast_record
     std::variant<ast_expr_ptr, std::string>     ast;
     size_t                                      mp_subtree_size = 1;
     hash_t                                      hashcode;
-    std::vector<std::string>                    varnames;
+    varnames_t                                  varnames;
     std::optional<mp_dependencies_t>            modus_ponens_deps;
-    std::optional<hash_t>                       l_hash;
 
     ast_record(ast_expr_ptr ptr);
 };
 
-using varnames_t = std::vector<std::string>;
-
 struct hypotesis_set
 {
     explicit hypotesis_set(varnames_t const&);
@@ -30,11 +29,14 @@ struct hypotesis_set
     hypotesis_set(hypotesis_set&& other) noexcept;
     hypotesis_set& operator=(hypotesis_set&& rhs) noexcept;
 
-    std::unordered_map<std::string, bool> mp;
+    std::unordered_map<var_id, bool> mp;
     varnames_t const& varnames;
 };
 
 
+// Pool of every formula the proof generator builds
+ast_pool& formula_pool();
+
 static inline bool is_op(ast_expression const* ptr)
 {
     return ptr->content.index() == 0;
@@ -77,23 +79,19 @@ static inline decltype(auto) subtree(T* ptr,
                                      size_t ind)
 {
     assert(ind >= 0 && ind <= 1);
-    return get_op(ptr).argv[ind].get();
+    return get_op(ptr).argv[ind];
 }
 
 static inline
 ast_expr_ptr negated(ast_expr_ptr ptr)
 {
-    ast_expression::chld_v tmp_v;
-    tmp_v.push_back(std::move(ptr));
-
-    auto op = ast_expression::operation{std::move(tmp_v), operation_type::NEG};
-    return std::make_unique<ast_expression>(std::move(op));
+    return formula_pool().intern(operation_type::NEG, {ptr});
 }
 
 static inline
 ast_expr_ptr take_off_negated(ast_expr_ptr ptr)
 {
-    return std::move(get_op(ptr.get()).argv[0]);
+    return get_op(ptr).argv[0];
 }
 
 bool is_valid(ast_expression const* ast,
@@ -101,6 +99,6 @@ bool is_valid(ast_expression const* ast,
 
 std::optional<hypotesis_set>
 try_find_hypset(ast_expr_ptr& ast_rec,
-                std::vector<std::string> const& varnames);
+                varnames_t const& varnames);
 
 #endif // AST_RECORD_H
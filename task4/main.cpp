@@ -2,6 +2,7 @@
 #include "templates.h"
 #include "ast_record.h"
 #include "proof.h"
+#include "binproof.h"
 
 #include <iostream>
 #include <unordered_map>
@@ -15,7 +16,9 @@ using namespace std;
 
 using all_ast_trees_t = vector<unique_ptr<ast_record>>;
 
-int main()
+// Usage: main [--binary] < formula
+//   --binary   print the proof in the binary format instead of text
+int main(int argc, char* argv[])
 {
     ios_base::sync_with_stdio(false);
 
@@ -25,21 +28,50 @@ int main()
     std::string line;
     std::getline(std::cin, line);
 
-    std::string_view view = line;
-    result = parse_expr(view);
+    parser prs(formula_pool(), line);
+    result = parse_expr(prs);
 
     auto ast_rec = ast_record{move(result)};
 
     auto hyp_set_opt = try_find_hypset(std::get<0>(ast_rec.ast), ast_rec.varnames);
+    bool const binary_output = argc > 1 && argv[1] == std::string("--binary");
 
-    if (hyp_set_opt)
+    if (hyp_set_opt && binary_output)
+    {
+        auto& hyp_set = *hyp_set_opt;
+        bin_proof proof;
+        for (auto&& var : hyp_set.varnames)
+        {
+            auto it = hyp_set.mp.find(var);
+            if (it != hyp_set.mp.end())
+                proof.hypotheses.push_back(it->second ? negated(formula_pool().intern(var))
+                                                      : formula_pool().intern(var));
+        }
+        proof.goal = std::get<0>(ast_rec.ast);
+
+        // templates produce text, so the lines are parsed once here
+        std::vector<std::string> vec;
+        echo_proof(vec, proof.goal, hyp_set);
+        parser prs(formula_pool());
+        for (auto&& line : vec)
+        {
+            prs.input = line;
+            proof.lines.push_back(parse_expr(prs));
+        }
+        write_bin_proof(std::cout, proof);
+    }
+    else if (hyp_set_opt)
     {
         auto& hyp_set = *hyp_set_opt;
 
         {
             std::vector<std::string> vec;
-            for (auto&& varname : hyp_set.mp)
-                vec.emplace_back((varname.second ? "!" : "") + varname.first);
+            for (auto&& var : hyp_set.varnames)
+            {
+                auto it = hyp_set.mp.find(var);
+                if (it != hyp_set.mp.end())
+                    vec.emplace_back((it->second ? "!" : "") + std::string(formula_pool().name(var)));
+            }
            if (vec.size())
                 std::cout << vec[0];
             for (size_t i = 1; i < vec.size(); ++i)
@@ -47,8 +79,8 @@ int main()
             std::cout << " |- ";
             std::cout << *std::get<0>(ast_rec.ast) << std::endl;
             vec.clear();
-            auto kek = std::get<0>(ast_rec.ast).get();
-            echo_proof(vec, std::get<0>(ast_rec.ast).get(), hyp_set);
+            auto kek = std::get<0>(ast_rec.ast);
+            echo_proof(vec, std::get<0>(ast_rec.ast), hyp_set);
             for (auto&& pr : vec)
                 std::cout << pr << "\n";
             std::cout.flush();
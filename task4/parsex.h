@@ -5,6 +5,10 @@
 #include <memory>
 #include <variant>
 #include <array>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <cstdint>
 
 enum class token_type
 {
@@ -25,12 +29,12 @@ enum class operation_type
     IMPL
 };
 
-using varname = std::string;
-using lex_token = std::variant<token_type, varname, std::nullptr_t>;
+using var_id = uint32_t; // dense per-pool variable id, see ast_pool::var()
+using lex_token = std::variant<token_type, var_id, std::nullptr_t>;
 
 enum
 {
-    hash_n = 1
+    hash_n = 2  // independent polynomial hash lanes, 1 to 4
 };
 
 
@@ -42,9 +46,22 @@ struct hash_t_hash
     size_t operator()(hash_t const& H) const;
 };
 
+struct ast_expression;
+using ast_expr_ptr = ast_expression const*;
+
 struct ast_expression
 {
-    using chld_v = std::vector<std::unique_ptr<ast_expression>>;
+    // Children array, owned by the ast_pool the node lives in
+    struct chld_v
+    {
+        ast_expr_ptr const* data;
+        size_t              n;
+
+        ast_expr_ptr const* begin() const { return data; }
+        ast_expr_ptr const* end() const { return data + n; }
+        size_t size() const { return n; }
+        ast_expr_ptr operator[](size_t i) const { return data[i]; }
+    };
 
     struct operation
     {
@@ -52,24 +69,110 @@ struct ast_expression
         operation_type op_type;
     };
 
+    // Leaf; the name is only kept for output, everything else goes by id
+    struct variable
+    {
+        var_id           id;
+        std::string_view name;
+    };
+
     ast_expression(operation&& op);
-    ast_expression(std::string varname);
+    ast_expression(variable var, hash_t const& name_hash);
 
-    std::variant<operation, varname> content;
+    std::variant<operation, variable> content;
     hash_t hashcode;
     size_t const subtree_sz;
+    hash_t p_pow;   // P^subtree_sz, for hashing the parents
+};
+
+// Owns every node of a proof, with child arrays and variable names, in a bump
+// arena that is freed at once. Nodes are hash-consed: intern() returns the
+// existing node for a formula, so structurally equal formulas are pointer-equal.
+// Children passed to intern() must belong to the same pool.
+// Variable names are interned once into dense ids, each id owning its leaf.
+class ast_pool
+{
+public:
+    ast_pool() = default;
+    ast_pool(ast_pool const&) = delete;
+    ast_pool& operator=(ast_pool const&) = delete;
+
+    ast_expr_ptr    intern(operation_type op_type,
+                           std::initializer_list<ast_expr_ptr> argv);
+    ast_expr_ptr    intern(var_id id) const { return leaves[id]; }
+    ast_expr_ptr    intern(std::string_view varname) { return intern(var(varname)); }
+    var_id          var(std::string_view varname);
+    std::string_view name(var_id id) const;
+    size_t          vars_count() const { return leaves.size(); }
+    void            clear();
+
+private:
+    enum
+    {
+        block_size = 1u << 16
+    };
+
+    void*           allocate(size_t size, size_t align);
+    ast_expr_ptr&   find_slot(ast_expression const& expr);
+    ast_expr_ptr    insert(ast_expr_ptr& slot, ast_expression const& expr);
+
+    std::vector<std::unique_ptr<char[]>>    blocks;
+    char*                                   block_left = nullptr;
+    char*                                   block_right = nullptr;
+    std::vector<ast_expr_ptr>               table; // open addressing, size is a power of 2
+    size_t                                  nodes_cnt = 0;
+    std::unordered_map<std::string_view, var_id> var_ids; // keys point into the arena
+    std::vector<ast_expr_ptr>               leaves;  // by var_id
+};
+
+// Parsing state of one input: the unparsed rest of it, the lookahead token
+// and the operator precedence stacks, with the pool formulas are interned
+// into. Parsers share no state, so each thread can run its own.
+struct parser
+{
+    explicit parser(ast_pool& pool, std::string_view input = {})
+        : input(input),
+          pool(pool)
+    {}
+
+    std::string_view            input;
+    ast_pool&                   pool;
+    lex_token                   cur_token = nullptr;
+    std::vector<ast_expr_ptr>   operands;   // parse_expr() stacks, kept to reuse the memory
+    std::vector<token_type>     operators;
+};
+
+// Compact postorder encoding of a formula: every distinct subformula once,
+// children before their parent, root last. Evaluating or walking it is a
+// single linear sweep over a contiguous array.
+struct flat_node
+{
+    uint32_t        lhs;        // child indices; lhs only for NEG, none for vars
+    uint32_t        rhs;
+    uint32_t        var_ix;     // index in flat_ast::vars, vars only
+    uint32_t        subtree_sz;
+    hash_t          hashcode;
+    operation_type  op_type;
+    bool            is_var;
+};
+
+struct flat_ast
+{
+    std::vector<flat_node>          nodes;
+    std::vector<var_id>             vars;   // in order of first occurrence
 };
 
-using ast_expr_ptr = std::unique_ptr<ast_expression>;
+flat_ast        flatten(ast_expr_ptr expr);
 
 // helpers
-ast_expr_ptr    parse_expr(std::string_view& view);
+ast_expr_ptr    parse_expr(parser& prs); // one formula off the front of prs.input
 
 // output helpers
 char const*     to_string(token_type token_type);
 char const*     to_string(operation_type const token_type);
 std::string     to_string(lex_token const& token_type);
 std::string     to_string(hash_t const& hsh);
+bool            structurally_equal(ast_expr_ptr lhs, ast_expr_ptr rhs);
 std::string     to_string(ast_expression const& expr);
 std::ostream&   operator<<(std::ostream& o, ast_expression const& expr);
 
@@ -1,23 +1,36 @@
 #include "proof.h"
 #include "templates.h"
+#include "hash_index.h"
+#include "mp_index.h"
 
 #include <iostream>
 #include <map>
 #include <algorithm>
 #include <future>
 #include <sstream>
+#include <tuple>
+
+// A hypothesis itself or its negation, i.e. a line that is proven as-is
+static inline
+bool is_hypotesis(ast_expr_ptr ast,
+                  hypotesis_set const& hyp_set)
+{
+    if (is_op(ast, operation_type::NEG))
+        ast = take_off_negated(ast);
+    return !is_op(ast)
+        && hyp_set.mp.count(std::get<ast_expression::variable>(ast->content).id);
+}
 
 static inline
 void deduct(std::vector<std::string>& proof,
             ast_record& alha,
             hypotesis_set const& hyp_set)
 {
-    using hash_to_record_t = std::unordered_map<hash_t, ast_record*, hash_t_hash>;
-    using ast_set_by_hash_t = std::unordered_map<hash_t, std::unordered_map<hash_t, ast_record*, hash_t_hash>, hash_t_hash>;
+    using hash_to_record_t = hash_index<ast_record*>;
     using all_ast_trees_t = std::vector<std::unique_ptr<ast_record>>;
 
     hash_to_record_t                        proven_by_hash;
-    ast_set_by_hash_t                       proven_impl_by_right_subtree_hash;
+    mp_index<ast_record*>                   modus_ponens;
     all_ast_trees_t                         all_asts;
     std::map<hash_t, std::string>           right_tr;
 
@@ -27,14 +40,15 @@ void deduct(std::vector<std::string>& proof,
     auto&& alpha = *std::get<0>(alha.ast);
     auto&& alpha_str = to_string(alpha);
 
+    parser prs(formula_pool());
     for (auto&& line : proof)
     {
-        std::string_view line_view(line);
-        all_asts.push_back(std::make_unique<ast_record>(parse_expr(line_view)));
+        prs.input = line;
+        all_asts.push_back(std::make_unique<ast_record>(parse_expr(prs)));
         auto ast_rec = all_asts.back().get();
 
-        if (check_if_axiom(std::get<ast_expr_ptr>(ast_rec->ast).get())
-            || hyp_set.mp.count(line) || hyp_set.mp.count(line.substr(1)))
+        if (check_if_axiom(std::get<ast_expr_ptr>(ast_rec->ast))
+            || is_hypotesis(std::get<ast_expr_ptr>(ast_rec->ast), hyp_set))
         {
             result.push_back(line);
             result.push_back("(" + line + ") -> (" + to_string(alpha) + " -> (" + line + "))");
@@ -46,26 +60,16 @@ void deduct(std::vector<std::string>& proof,
         }
         else
         {
-            bool modus_ponens_found = false;
-            auto it = proven_impl_by_right_subtree_hash.find(ast_rec->hashcode);
-            if (it != proven_impl_by_right_subtree_hash.end())
+            auto mp = modus_ponens.find(ast_rec->hashcode);
+            bool modus_ponens_found = mp != nullptr;
+            if (modus_ponens_found)
             {
-                for (auto hash_and_parent : it->second)
-                {
-                    auto it2 = proven_by_hash.find(*hash_and_parent.second->l_hash);
-                    if (it2 == proven_by_hash.end()) continue;
-
-                    ast_rec->modus_ponens_deps = std::make_pair(hash_and_parent.second, it2->second);
-                    ast_rec->mp_subtree_size = hash_and_parent.second->mp_subtree_size
-                                             + it2->second->mp_subtree_size
-                                             + 1;
-                    modus_ponens_found = true;
-                    break;
-                }
+                ast_rec->modus_ponens_deps = std::make_pair(mp->impl, mp->premise);
+                ast_rec->mp_subtree_size = mp_cost(mp->cost, 1);
             }
 
-            if (is_op(std::get<0>(ast_rec->ast).get(), operation_type::IMPL))
-                right_tr[ast_rec->hashcode] = to_string(*subtree(std::get<0>(ast_rec->ast).get(), 1));
+            if (is_op(std::get<0>(ast_rec->ast), operation_type::IMPL))
+                right_tr[ast_rec->hashcode] = to_string(*subtree(std::get<0>(ast_rec->ast), 1));
 
             assert(modus_ponens_found && "WAT");
             auto rit = right_tr.find(ast_rec->modus_ponens_deps->first->hashcode);
@@ -76,12 +80,24 @@ void deduct(std::vector<std::string>& proof,
                      rit->second);
         }
 
-        proven_by_hash[ast_rec->hashcode] = ast_rec;
-        if (is_op(std::get<0>(ast_rec->ast).get(), operation_type::IMPL))
+        // every proof of a formula gives the same text, the first one will do
+        if (proven_by_hash.insert({ast_rec->hashcode, ast_rec}).second)
         {
-            proven_impl_by_right_subtree_hash[subtree(std::get<0>(ast_rec->ast).get(), 1)->hashcode][ast_rec->hashcode] = ast_rec;
-            right_tr[ast_rec->hashcode] = to_string(*subtree(std::get<0>(ast_rec->ast).get(), 1));
+            modus_ponens.proven(ast_rec->hashcode, ast_rec, ast_rec->mp_subtree_size);
+            if (is_op(std::get<0>(ast_rec->ast), operation_type::IMPL))
+            {
+                auto antecedent = subtree(std::get<0>(ast_rec->ast), 0)->hashcode;
+                auto consequent = subtree(std::get<0>(ast_rec->ast), 1)->hashcode;
+                auto premise = proven_by_hash.find(antecedent);
+                if (premise != proven_by_hash.end())
+                    modus_ponens.offer(consequent, ast_rec, premise->second,
+                                       mp_cost(ast_rec->mp_subtree_size, premise->second->mp_subtree_size));
+                else
+                    modus_ponens.implication(ast_rec, ast_rec->mp_subtree_size, antecedent, consequent);
+            }
         }
+        if (is_op(std::get<0>(ast_rec->ast), operation_type::IMPL))
+            right_tr[ast_rec->hashcode] = to_string(*subtree(std::get<0>(ast_rec->ast), 1));
 
         {
             std::stringstream kek;
@@ -93,53 +109,94 @@ void deduct(std::vector<std::string>& proof,
     proof = std::move(result);
 }
 
+// Proves ast by cases on the variable whose two cases, under it and under
+// its negation, take the fewest lines, ties going to the one first in
+// varnames. Each case is then deduced into an implication, which triples
+// its lines, and the two are joined by the excluded middle. The same
+// formula comes up under the same hypotheses in many orders of the cases,
+// so the proof for each is kept.
 static inline
 void bruteforce(std::vector<std::string>& out,
-                ast_expression* ast,
+                ast_expr_ptr ast,
                 hypotesis_set const& hyp_set)
 {
     assert(is_valid(ast, hyp_set));
 
+    // hypotheses as masks over varnames: which are set, and which negated
+    uint16_t set = 0;
+    uint16_t neg = 0;
+    for (size_t i = 0; i < hyp_set.varnames.size(); ++i)
+    {
+        auto it = hyp_set.mp.find(hyp_set.varnames[i]);
+        if (it == hyp_set.mp.end())
+            continue;
+        set |= 1 << i;
+        neg |= static_cast<uint16_t>(it->second) << i;
+    }
+
+    static std::map<std::tuple<ast_expr_ptr, uint16_t, uint16_t>,
+                    std::vector<std::string>> proven;
+    auto key = std::make_tuple(ast, set, neg);
+    auto it = proven.find(key);
+    if (it != proven.end())
+    {
+        out.insert(out.end(), it->second.begin(), it->second.end());
+        return;
+    }
+
     hypotesis_set tmp(hyp_set.varnames);
     tmp.mp = hyp_set.mp;
 
     std::vector<std::string> proof1, proof2;
+    var_id varname = 0;
+    bool found = false;
+    for (size_t i = 0; i < hyp_set.varnames.size(); ++i)
+    {
+        if (set >> i & 1)
+            continue;
+
+        var_id var = hyp_set.varnames[i];
+        std::vector<std::string> cases[2];
+        tmp.mp[var] = false;
+        echo_proof(cases[0], ast, tmp);
+        tmp.mp[var] = true;
+        echo_proof(cases[1], ast, tmp);
+        tmp.mp.erase(var);
+
+        if (!found || cases[0].size() + cases[1].size() < proof1.size() + proof2.size())
+        {
+            proof1 = std::move(cases[0]);
+            proof2 = std::move(cases[1]);
+            varname = var;
+        }
+        found = true;
+    }
+    assert(found);
 
-    auto&& varname = *std::find_if_not(hyp_set.varnames.begin(),
-                                      hyp_set.varnames.end(),
-                                      [&tmp] (std::string const& var) { return tmp.mp.count(var); });
-
-    assert(!tmp.mp.count(varname));
-    tmp.mp[varname] = false;
-    echo_proof(proof1, ast, tmp);
-
-    tmp.mp[varname] = true;
-    echo_proof(proof2, ast, tmp);
-
-    ast_record ast_rc(std::make_unique<ast_expression>(varname));
-
-    auto it = tmp.mp.find(varname);
-    assert(it != tmp.mp.end());
-    tmp.mp.erase(it);
+    ast_record ast_rc(formula_pool().intern(varname));
 
     deduct(proof1, ast_rc, tmp);
 
-    ast_rc = negated(std::move(std::get<0>(ast_rc.ast)));
+    ast_rc = negated(std::get<0>(ast_rc.ast));
     deduct(proof2, ast_rc, tmp);
 
+    std::vector<std::string> result;
     for (auto&& line : proof1)
-        out.push_back(std::move(line));
+        result.push_back(std::move(line));
     for (auto&& line : proof2)
-        out.push_back(std::move(line));
-    ast_rc = take_off_negated(std::move(std::get<0>(ast_rc.ast)));
+        result.push_back(std::move(line));
+    ast_rc = take_off_negated(std::get<0>(ast_rc.ast));
+
+    excl_third(result, *std::get<0>(ast_rc.ast));
 
-    excl_third(out, *std::get<0>(ast_rc.ast));
+    excl_assumpion(result, *std::get<0>(ast_rc.ast), *ast);
 
-    excl_assumpion(out, *std::get<0>(ast_rc.ast), *ast);
+    out.insert(out.end(), result.begin(), result.end());
+    proven.emplace(key, std::move(result));
 }
 
 void echo_proof(std::vector<std::string>& out,
-                ast_expression* ast,
+                ast_expr_ptr ast,
                 hypotesis_set const& hyp_set)
 {
     if (check_if_axiom(ast))
@@ -169,13 +226,13 @@ void echo_proof(std::vector<std::string>& out,
             && subtree(ast, 0)->content.index() == 1)
         {
             auto chld = subtree(ast, 0);
-            auto&& varname = std::get<1>(chld->content);
+            auto&& var = std::get<1>(chld->content);
 
-            auto it = hyp_set.mp.find(varname);
+            auto it = hyp_set.mp.find(var.id);
             assert(it != hyp_set.mp.end() && "Improvable variable found!");
             assert(it->second && "Negated variable found, but not negated in hyp set");
 
-            out.push_back("!" + varname);
+            out.push_back("!" + std::string(var.name));
             return;
         }
 
@@ -228,29 +285,19 @@ void echo_proof(std::vector<std::string>& out,
                 return;
             }
 
-            ast_expression::chld_v children = std::move(get_op(ast).argv);
-            for (size_t i = 0; i < 2; ++i)
-                children[i] = negated(std::move(children[i]));
+            ast_expr_ptr children[] = {negated(subtree(ast, 0)),
+                                       negated(subtree(ast, 1))};
 
-            if (is_valid(children[0].get(), hyp_set)
-                && is_valid(children[1].get(), hyp_set))
+            if (is_valid(children[0], hyp_set)
+                && is_valid(children[1], hyp_set))
             {
                 for (size_t i = 0; i < 2; ++i)
-                    echo_proof(out, children[i].get(), hyp_set);
-
-                for (size_t i = 0; i < 2; ++i   )
-                    children[i] = take_off_negated(std::move(children[i]));
-
-                implication_from_negs(out, *children[0], *children[1]);
+                    echo_proof(out, children[i], hyp_set);
 
-                get_op(ast).argv = move(children);
+                implication_from_negs(out, *subtree(ast, 0), *subtree(ast, 1));
                 return;
             }
 
-            for (size_t i = 0; i < 2; ++i)
-                children[i] = take_off_negated(std::move(children[i]));
-            get_op(ast).argv = move(children);
-
             bruteforce(out, ast, hyp_set);
             return;
         }
@@ -258,38 +305,24 @@ void echo_proof(std::vector<std::string>& out,
         if (is_op(ast, op_t::NEG)
             && is_op(subtree(ast, 0), op_t::CONJ))
         {
-            ast_expression::chld_v children = std::move(get_op(subtree(ast, 0)).argv);
-            for (size_t i = 0; i < 2; ++i)
-                children[i] = negated(std::move(children[i]));
+            auto const& conj = get_op(subtree(ast, 0)).argv;
+            ast_expr_ptr children[] = {negated(conj[0]),
+                                       negated(conj[1])};
 
-            if (is_valid(children[0].get(), hyp_set))
+            if (is_valid(children[0], hyp_set))
             {
-                echo_proof(out, children[0].get(), hyp_set);
-
-                for (size_t i = 0; i < 2; ++i)
-                    children[i] = take_off_negated(std::move(children[i]));
-
-                neg_conj_from_A(out, *children[0], *children[1]);
-                get_op(subtree(ast, 0)).argv = std::move(children);
+                echo_proof(out, children[0], hyp_set);
+                neg_conj_from_A(out, *conj[0], *conj[1]);
                 return;
             }
-            else if (is_valid(children[1].get(), hyp_set))
+            else if (is_valid(children[1], hyp_set))
             {
-                echo_proof(out, children[1].get(), hyp_set);
-
-                for (size_t i = 0; i < 2; ++i)
-                    children[i] = take_off_negated(std::move(children[i]));
-
-                neg_conj_from_B(out, *children[0], *children[1]);
-                get_op(subtree(ast, 0)).argv = std::move(children);
+                echo_proof(out, children[1], hyp_set);
+                neg_conj_from_B(out, *conj[0], *conj[1]);
                 return;
             }
             else
             {
-                for (size_t i = 0; i < 2; ++i)
-                    children[i] = take_off_negated(std::move(children[i]));
-                get_op(subtree(ast, 0)).argv = std::move(children);
-
                 bruteforce(out, ast, hyp_set);
             }
             return;
@@ -298,48 +331,38 @@ void echo_proof(std::vector<std::string>& out,
         if (is_op(ast, op_t::NEG)
             && is_op(subtree(ast, 0), op_t::DISJ))
         {
-            ast_expression::chld_v children = std::move(get_op(subtree(ast, 0)).argv);
+            auto const& children = get_op(subtree(ast, 0)).argv;
             for (size_t i = 0; i < 2; ++i)
             {
-                children[i] = negated(std::move(children[i]));
-                assert(is_valid(children[i].get(), hyp_set));
-                echo_proof(out, children[i].get(), hyp_set);
-                children[i] = take_off_negated(std::move(children[i]));
+                auto neg_child = negated(children[i]);
+                assert(is_valid(neg_child, hyp_set));
+                echo_proof(out, neg_child, hyp_set);
             }
 
             neg_disj(out, *children[0], *children[1]);
-
-            get_op(subtree(ast, 0)).argv = std::move(children);
             return;
         }
 
         if (is_op(ast, op_t::NEG)
             && is_op(subtree(ast, 0), op_t::IMPL))
         {
-            ast_expression::chld_v children = std::move(get_op(subtree(ast, 0)).argv);
-
-            children[1] = negated(std::move(children[1]));
+            auto const& impl = get_op(subtree(ast, 0)).argv;
+            ast_expr_ptr children[] = {impl[0],
+                                       negated(impl[1])};
 
-            if (is_valid(children[0].get(), hyp_set)
-                && is_valid(children[1].get(), hyp_set))
+            if (is_valid(children[0], hyp_set)
+                && is_valid(children[1], hyp_set))
             {
                 for (size_t i = 0; i < 2; ++i)
                 {
-                    assert(is_valid(children[i].get(), hyp_set));
-                    echo_proof(out, children[i].get(), hyp_set);
+                    assert(is_valid(children[i], hyp_set));
+                    echo_proof(out, children[i], hyp_set);
                 }
 
-                children[1] = take_off_negated(std::move(children[1]));
-
-                neg_impl(out, *children[0], *children[1]);
-
-                get_op(subtree(ast, 0)).argv = std::move(children);
+                neg_impl(out, *impl[0], *impl[1]);
                 return;
             }
 
-            children[1] = take_off_negated(std::move(children[1]));
-            get_op(subtree(ast, 0)).argv = std::move(children);
-
             bruteforce(out, ast, hyp_set);
 
             return;
@@ -350,13 +373,13 @@ void echo_proof(std::vector<std::string>& out,
     }
     case 1:
     {
-        auto&& varname = std::get<1>(ast->content);
+        auto&& var = std::get<1>(ast->content);
 
-        auto it = hyp_set.mp.find(varname);
+        auto it = hyp_set.mp.find(var.id);
         assert(it != hyp_set.mp.end() && "Improvable variable found!");
         assert(!it->second && "Not negated variable found, but negated in hyp set");
 
-        out.push_back(varname);
+        out.push_back(std::string(var.name));
         return;
     }
     default:
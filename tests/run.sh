@@ -0,0 +1,68 @@
+#!/bin/bash
+# Regression tests for the tasks; builds them first. Run from anywhere:
+#   tests/run.sh
+# Prints a line per failing case and exits with 1 if there was any.
+
+cd "$(dirname "$0")/.." || exit 1
+for t in task2 task3 task4; do
+    make -s -C $t >/dev/null 2>&1 || { echo "build of $t failed"; exit 1; }
+done
+
+failed=0
+fail()
+{
+    echo "FAIL: $1"
+    failed=1
+}
+
+# A->A->...->A, n variables, and how the tasks print it
+deep_formula()
+{
+    printf 'A->%.0s' $(seq $(($1 - 1)))
+    echo A
+}
+deep_printed()
+{
+    printf '(A -> %.0s' $(seq $(($1 - 1)))
+    printf A
+    printf ')%.0s' $(seq $(($1 - 1)))
+    echo
+}
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+# Formulas far deeper than the native stack are printed as well as parsed
+f=$(deep_formula 200000)
+printf '%s|-%s\n%s\n' "$f" "$f" "$f" > $tmp/deep.txt
+deep_printed 200000 > $tmp/deep.expected
+task2/main < $tmp/deep.txt > $tmp/out || fail "task2 deep formula: rc $?"
+tail -n 1 $tmp/out | sed 's/^\[1\. Hypothesis 1\] //' | cmp -s - $tmp/deep.expected \
+    || fail "task2 deep formula: wrong output"
+# task3 prints the translated header, then the hypothesis
+task3/main < $tmp/deep.txt > $tmp/out || fail "task3 deep formula: rc $?"
+sed -n 2p $tmp/out | cmp -s - $tmp/deep.expected || fail "task3 deep formula: wrong output"
+
+# Seventeen schemes, whose decision tree used to be over the node budget
+task2/main --axioms tests/axioms17.txt < tests/axioms17_proof.txt > $tmp/out \
+    && cmp -s $tmp/out tests/axioms17.expected || fail "task2 --axioms with 17 schemes"
+
+# --minimize=exact: reusing Z3 beats the chain with the smaller proof tree
+# that --minimize picks, and the second line proving F takes a pair that
+# comes too late for the first one
+for t in shared repeated; do
+    task2/main --minimize=exact < tests/minimize_$t.txt > $tmp/out \
+        && cmp -s $tmp/out tests/minimize_$t.expected || fail "task2 --minimize=exact on minimize_$t.txt"
+done
+[ $(task2/main --minimize < tests/minimize_shared.txt | wc -l) -gt $(wc -l < tests/minimize_shared.expected) ] \
+    || fail "task2 --minimize=exact no shorter than --minimize"
+
+# task4's proofs of the sample formulas pass task2 and don't get longer
+while read -r most formula; do
+    echo "$formula" | task4/main > $tmp/proof
+    task2/main < $tmp/proof | grep -q "Proof is incorrect" && fail "task4 $formula: incorrect proof"
+    lines=$(wc -l < $tmp/proof)
+    [ $lines -le $most ] || fail "task4 $formula: $lines lines, $most at most"
+done < <(grep -v '^#' tests/proof_lengths.txt)
+
+exit $failed